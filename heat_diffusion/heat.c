@@ -12,6 +12,17 @@
 #define T_AMBIENT 15.0 // Initial ambient/cold temperature [°C]
 #define WX 0.3         // Diffusion coefficient in X-direction (for anisotropy)
 #define WY 0.2         // Diffusion coefficient in Y-direction (for anisotropy)
+#define TILE 32        // Side of the tiles tracked by the active mode
+#define NUM_TILES ((N + TILE - 1) / TILE) // Tiles per side of the grid
+
+// Active mode: only the tiles whose neighbourhood changed in the previous iteration are updated
+typedef struct {
+    unsigned char active[NUM_TILES][NUM_TILES];  // tiles to update in this iteration
+    unsigned char changed[NUM_TILES][NUM_TILES]; // tiles whose cells changed by more than the threshold in this iteration
+    int ti0, ti1, tj0, tj1;                      // bounding box of the active tiles (inclusive), empty if ti0 > ti1
+    long long skipped;                           // cell updates skipped so far
+    long long total;                             // cell updates of the full sweep so far
+} ActiveRegion;
 
 
 //Functions definitions
@@ -135,23 +146,156 @@ void save_execution_time(FILE *f, double exec_time, int num_threads) {
     printf("Execution time with %d threads saved.\n", num_threads);
 }
 
+// Marks all the tiles as active (first iteration: nothing is known about the previous one)
+void init_active_region(ActiveRegion *region) {
+    memset(region->active, 1, sizeof(region->active));
+    region->ti0 = 0;
+    region->ti1 = NUM_TILES - 1;
+    region->tj0 = 0;
+    region->tj1 = NUM_TILES - 1;
+    region->skipped = 0;
+    region->total = 0;
+}
+
+// Internal cells of tile (ti, tj): rows [i0, i1) and columns [j0, j1), without the fixed boundary of the grid
+static void tile_bounds(int ti, int tj, int *i0, int *i1, int *j0, int *j1) {
+    *i0 = ti * TILE > 1 ? ti * TILE : 1;
+    *i1 = (ti + 1) * TILE < N - 1 ? (ti + 1) * TILE : N - 1;
+    *j0 = tj * TILE > 1 ? tj * TILE : 1;
+    *j1 = (tj + 1) * TILE < N - 1 ? (tj + 1) * TILE : N - 1;
+}
+
+// Updates the internal cells of tile (ti, tj) into new_grid and returns the largest change of its cells
+double update_tile(double **grid, double **new_grid, int ti, int tj, int anisotropic) {
+    int i0, i1, j0, j1;
+    tile_bounds(ti, tj, &i0, &i1, &j0, &j1);
+    double max_change = 0.0;
+
+    for (int i = i0; i < i1; i++) {
+        if (anisotropic) {
+            #pragma omp simd reduction(max:max_change)
+            for (int j = j0; j < j1; j++) {
+                new_grid[i][j] = WX * (grid[i][j-1] + grid[i][j+1]) + WY * (grid[i-1][j] + grid[i+1][j]);
+                double change = fabs(new_grid[i][j] - grid[i][j]);
+                max_change = change > max_change ? change : max_change;
+            }
+        } else {
+            #pragma omp simd reduction(max:max_change)
+            for (int j = j0; j < j1; j++) {
+                new_grid[i][j] = 0.25 * (grid[i+1][j] + grid[i-1][j] + grid[i][j+1] + grid[i][j-1]);
+                double change = fabs(new_grid[i][j] - grid[i][j]);
+                max_change = change > max_change ? change : max_change;
+            }
+        }
+    }
+    return max_change;
+}
+
+// Number of internal cells of tile (ti, tj)
+long long tile_cells(int ti, int tj) {
+    int i0, i1, j0, j1;
+    tile_bounds(ti, tj, &i0, &i1, &j0, &j1);
+    return (long long)(i1 - i0) * (j1 - j0);
+}
+
+// One iteration of the active mode.
+// A tile is updated only if one of the 3x3 tiles around it changed by more than the threshold in the previous iteration:
+// otherwise the cells it reads are the same as in the previous iteration and so is its result.
+// With threshold 0 the grid is exactly the one of the full sweep.
+void active_sweep(double **grid, double **new_grid, ActiveRegion *region, int anisotropic, double threshold) {
+    memset(region->changed, 0, sizeof(region->changed));
+
+    // Update the active tiles into new_grid: grid is only read here
+    #pragma omp parallel for collapse(2) schedule(dynamic)
+    for (int ti = region->ti0; ti <= region->ti1; ti++) {
+        for (int tj = region->tj0; tj <= region->tj1; tj++) {
+            if (region->active[ti][tj]) {
+                region->changed[ti][tj] = update_tile(grid, new_grid, ti, tj, anisotropic) > threshold;
+            }
+        }
+    }
+
+    // Copy back only the active tiles, the others did not change
+    #pragma omp parallel for collapse(2) schedule(dynamic)
+    for (int ti = region->ti0; ti <= region->ti1; ti++) {
+        for (int tj = region->tj0; tj <= region->tj1; tj++) {
+            if (region->active[ti][tj]) {
+                int i0, i1, j0, j1;
+                tile_bounds(ti, tj, &i0, &i1, &j0, &j1);
+                for (int i = i0; i < i1; i++) {
+                    memcpy(&grid[i][j0], &new_grid[i][j0], (j1 - j0) * sizeof(double));
+                }
+            }
+        }
+    }
+
+    // Count the skipped updates, then grow (or shrink) the active region around the tiles that changed
+    for (int ti = 0; ti < NUM_TILES; ti++) {
+        for (int tj = 0; tj < NUM_TILES; tj++) {
+            long long cells = tile_cells(ti, tj);
+            region->total += cells;
+            if (!region->active[ti][tj]) region->skipped += cells;
+        }
+    }
+    region->ti0 = NUM_TILES;
+    region->ti1 = -1;
+    region->tj0 = NUM_TILES;
+    region->tj1 = -1;
+    for (int ti = 0; ti < NUM_TILES; ti++) {
+        for (int tj = 0; tj < NUM_TILES; tj++) {
+            int active = 0;
+            for (int di = -1; di <= 1 && !active; di++) {
+                for (int dj = -1; dj <= 1 && !active; dj++) {
+                    int ni = ti + di, nj = tj + dj;
+                    if (ni >= 0 && ni < NUM_TILES && nj >= 0 && nj < NUM_TILES) active = region->changed[ni][nj];
+                }
+            }
+            region->active[ti][tj] = (unsigned char)active;
+            if (active) {
+                if (ti < region->ti0) region->ti0 = ti;
+                if (ti > region->ti1) region->ti1 = ti;
+                if (tj < region->tj0) region->tj0 = tj;
+                if (tj > region->tj1) region->tj1 = tj;
+            }
+        }
+    }
+}
+
+// Prints the fraction of the cell updates skipped by the active mode
+void print_skipped_fraction(const ActiveRegion *region, const char *config_name) {
+    double fraction = region->total > 0 ? (double)region->skipped / region->total : 0.0;
+    printf("Active mode (%s): %.2f%% of the cell updates skipped (%lld of %lld)\n",
+           config_name, 100.0 * fraction, region->skipped, region->total);
+}
+
 // Simulates isotropic heat diffusion
-void simulate_isotropic(double **grid, double **new_grid, FILE *point_file, FILE *exec_file, const char *config_name, int save_temp, int save_time, int num_threads) {
+void simulate_isotropic(double **grid, double **new_grid, FILE *point_file, FILE *exec_file, const char *config_name, int save_temp, int save_time, int num_threads,
+                        int active_mode, double threshold) {
+    ActiveRegion *region = NULL;
+    if (active_mode) {
+        region = malloc(sizeof(ActiveRegion));
+        if (region == NULL) { perror("Failed to allocate active region"); exit(EXIT_FAILURE); }
+        init_active_region(region);
+    }
      
     // Start timer
     double start_time = omp_get_wtime();
    
     for (int iter = 0; iter < MAX_ITER; iter++) {
-        copy_grid(grid, new_grid); // Copy entire grid (including boundaries)
-
-        #pragma omp parallel for collapse(2)
-        for (int i = 1; i < N - 1; i++) { // Loop for internal cells
-            for (int j = 1; j < N - 1; j++) {
-                new_grid[i][j] = 0.25 * (grid[i+1][j] + grid[i-1][j] + grid[i][j+1] + grid[i][j-1]);
+        if (active_mode) {
+            active_sweep(grid, new_grid, region, 0, threshold);
+        } else {
+            copy_grid(grid, new_grid); // Copy entire grid (including boundaries)
+
+            #pragma omp parallel for collapse(2)
+            for (int i = 1; i < N - 1; i++) { // Loop for internal cells
+                for (int j = 1; j < N - 1; j++) {
+                    new_grid[i][j] = 0.25 * (grid[i+1][j] + grid[i-1][j] + grid[i][j+1] + grid[i][j-1]);
+                }
             }
-        }
         
-        copy_grid(new_grid, grid); // Update the main grid
+            copy_grid(new_grid, grid); // Update the main grid
+        }
         
         if (save_temp) {
             
@@ -178,26 +322,41 @@ void simulate_isotropic(double **grid, double **new_grid, FILE *point_file, FILE
             // Saves execution time
             save_execution_time(exec_file, exec_time, num_threads); 
         }
+    if (active_mode) {
+        print_skipped_fraction(region, config_name);
+        free(region);
+    }
     
 }
 
 // Simulates anisotropic heat diffusion
-void simulate_anisotropic(double **grid, double **new_grid, FILE *point_file, FILE *exec_file, const char *config_name, int save_temp, int save_time, int num_threads) {
+void simulate_anisotropic(double **grid, double **new_grid, FILE *point_file, FILE *exec_file, const char *config_name, int save_temp, int save_time, int num_threads,
+                          int active_mode, double threshold) {
+    ActiveRegion *region = NULL;
+    if (active_mode) {
+        region = malloc(sizeof(ActiveRegion));
+        if (region == NULL) { perror("Failed to allocate active region"); exit(EXIT_FAILURE); }
+        init_active_region(region);
+    }
     
     // Start timer
     double start_time = omp_get_wtime();
     
     for (int iter = 0; iter < MAX_ITER; iter++) {
-        copy_grid(grid, new_grid);
-
-        #pragma omp parallel for collapse(2)
-        for (int i = 1; i < N - 1; i++) {
-            for (int j = 1; j < N - 1; j++) {
-                new_grid[i][j] = WX * (grid[i][j-1] + grid[i][j+1]) + WY * (grid[i-1][j] + grid[i+1][j]);
+        if (active_mode) {
+            active_sweep(grid, new_grid, region, 1, threshold);
+        } else {
+            copy_grid(grid, new_grid);
+
+            #pragma omp parallel for collapse(2)
+            for (int i = 1; i < N - 1; i++) {
+                for (int j = 1; j < N - 1; j++) {
+                    new_grid[i][j] = WX * (grid[i][j-1] + grid[i][j+1]) + WY * (grid[i-1][j] + grid[i+1][j]);
+                }
             }
-        }
 
-        copy_grid(new_grid, grid);
+            copy_grid(new_grid, grid);
+        }
 
         if (save_temp) {
             
@@ -226,6 +385,10 @@ void simulate_anisotropic(double **grid, double **new_grid, FILE *point_file, FI
             // Saves execution time
             save_execution_time(exec_file, exec_time, num_threads); 
         }
+    if (active_mode) {
+        print_skipped_fraction(region, config_name);
+        free(region);
+    }
 
 } 
 
@@ -233,8 +396,8 @@ void simulate_anisotropic(double **grid, double **new_grid, FILE *point_file, FI
 
 int main(int argc, char *argv[]) {
     // Command line argument parsing
-    if (argc != 4) {
-        fprintf(stderr, "Usage: %s [a|b|both] [temp|time] [num_threads]\n", argv[0]);
+    if (argc < 4 || argc > 6) {
+        fprintf(stderr, "Usage: %s [a|b|both] [temp|time] [num_threads] [full|active] [threshold]\n", argv[0]);
         return 1;
     }
 
@@ -250,7 +413,20 @@ int main(int argc, char *argv[]) {
     }
     omp_set_num_threads(num_threads);
 
-    printf("Simulation started with %d threads.\n", num_threads);
+    // Optional: "active" updates only the tiles around the cells that changed by more than threshold (default 0, same result
+    // as the full sweep) in the previous iteration
+    int active_mode = (argc >= 5 && strcmp(argv[4], "active") == 0);
+    if (argc >= 5 && !active_mode && strcmp(argv[4], "full") != 0) {
+        fprintf(stderr, "Error: sweep mode must be full or active.\n");
+        return 1;
+    }
+    double threshold = argc == 6 ? atof(argv[5]) : 0.0;
+    if (threshold < 0.0) {
+        fprintf(stderr, "Error: threshold must be a non-negative number.\n");
+        return 1;
+    }
+
+    printf("Simulation started with %d threads (%s sweep).\n", num_threads, active_mode ? "active" : "full");
 
     //Execute Configuration A
     if (run_config_A) {
@@ -292,7 +468,7 @@ int main(int argc, char *argv[]) {
         init_config_a(grid_a);
 
         printf("\nStarting configuration A (isotropic diffusion)\n");
-        simulate_isotropic(grid_a, new_grid_a, point_file_a, exec_file_a, "configA", save_temp_data, save_time_data, num_threads);
+        simulate_isotropic(grid_a, new_grid_a, point_file_a, exec_file_a, "configA", save_temp_data, save_time_data, num_threads, active_mode, threshold);
 
         if (save_temp_data) {
             if (point_file_a) fclose(point_file_a);
@@ -343,7 +519,7 @@ int main(int argc, char *argv[]) {
         init_config_b(grid_b);
 
         printf("\nStarting configuration B (anisotropic diffusion)\n");
-        simulate_anisotropic(grid_b, new_grid_b, point_file_b, exec_file_b, "configB", save_temp_data, save_time_data, num_threads);
+        simulate_anisotropic(grid_b, new_grid_b, point_file_b, exec_file_b, "configB", save_temp_data, save_time_data, num_threads, active_mode, threshold);
     
         if (save_temp_data) {
             if (point_file_b) fclose(point_file_b);
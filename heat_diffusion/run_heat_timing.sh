@@ -17,6 +17,8 @@ echo "Current directory: $(pwd)"
 HEAT_EXEC="./heat"
 THREAD_COUNTS=(1 2 4 6 8 10 12 14 16 18 20 22 24 26 28 30 32)
 CONFIGS=("a" "b")
+SWEEP_MODE="${1:-full}"  # full or active (only the tiles around the cells that changed, see heat.c)
+THRESHOLD="${2:-0}"      # active mode: change below which a tile is considered quiescent (0 = same result as full)
 
 rm -f exec_time_configA.txt
 rm -f exec_time_configB.txt
@@ -26,7 +28,7 @@ for config in "${CONFIGS[@]}"; do
     
     for num_threads in "${THREAD_COUNTS[@]}"; do
         echo "Running config $config with $num_threads threads for timing..."
-        $HEAT_EXEC "$config" "time" "$num_threads"
+        $HEAT_EXEC "$config" "time" "$num_threads" "$SWEEP_MODE" "$THRESHOLD"
         if [ $? -ne 0 ]; then
             echo "Error running heat executable for config $config with $num_threads threads."
         fi
@@ -2,30 +2,26 @@
 
 # This script processes all images in the 'reference' directory
 # by adding 50%, 75%, and 90% salt-and-pepper noise to each.
+# All the images and noise levels are made by a single AddSP process (AddSP.cpp):
+# every image is decoded once and its noisy versions are made in the same pass.
 
 SOURCE_DIR="../input/reference"
+OUTPUT_ROOT="../input"
 NOISE_LEVELS=(50 75 90)
-counter=1
 # Check if the source directory exists
 if [ ! -d "$SOURCE_DIR" ]; then
     echo "Error: Directory '$SOURCE_DIR' not found."
     exit 1
 fi
 
-# Loop through all common image files in the source directory
-for img_path in "$SOURCE_DIR"/*.{jpg,jpeg,png,bmp,tiff}; do
-    # Check if the file exists to avoid errors if no images are foun
-    if [ -f "$img_path" ]; then
-	echo "Processing image ${counter}"
-	if [ "$counter" -ge 37 ]; then
-        	# Loop through each noise level
-        	for amount in "${NOISE_LEVELS[@]}"; do
-            		echo "Processing '$img_path' with $amount% noise..."
-            		python3 AddS\&P.py "$img_path" "$amount"
-        	done
-	fi
-	((counter++))
-    fi
-done
+echo "----------  Starting Compiling  ------------------"
+g++ -std=c++17 -O3 -march=native -fopenmp AddSP.cpp -o AddSP \
+  -I/usr/include/opencv4 \
+  -L/usr/lib/aarch64-linux-gnu \
+  -lopencv_core -lopencv_imgcodecs
 
+# Results in $OUTPUT_ROOT/noiseXX/noisyXX_<image name>; add "-seed N" for a different (still reproducible) noise
+./AddSP "$SOURCE_DIR" "$OUTPUT_ROOT" "${NOISE_LEVELS[@]}"
+
+rm ./AddSP
 echo "Processing complete."
@@ -0,0 +1,262 @@
+#include <opencv2/opencv.hpp>
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cstdlib>
+#include <cstdint>
+#include <cmath>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <filesystem>
+#include <omp.h>
+#include "Es2_queue.h"
+#include "Es2_images.h"
+#define DEFAULT_SEED 2024   // Seed used when -seed is not given, so that two runs produce the same images
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+
+                                            Salt-and-pepper noise generator (native version of AddS&P.py)
+
+    AddSP <input_directory> <output_root> <amount> [<amount> ...] [-seed N] [-j threads]
+    Every image of the directory is decoded once and the noisy images of all the amounts are made in the same pass over its
+    pixels. They are saved as <output_root>/noiseXX/noisyXX_<image name>, the names used by AddS&P.py.
+
+------------------------------------------------------------------------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+
+                                                        Counter-based random numbers
+
+    There is no generator state: the random number of a pixel is a hash of (seed, image, amount, pixel index), so any thread
+    can compute any pixel in any order and the images are the same whatever the number of threads.
+
+------------------------------------------------------------------------------------------------------------------------------------------*/
+
+// splitmix64 finalizer
+static inline uint64_t mix64(uint64_t z) {
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+// FNV-1a hash of the image name: the noise of an image does not depend on the other files of the directory
+static uint64_t hashName(const std::string &name) {
+    uint64_t h = 0xCBF29CE484222325ull;
+    for (unsigned char c : name) {
+        h = (h ^ c) * 0x100000001B3ull;
+    }
+    return h;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+
+                                                            Probability of each pixel
+
+    AddS&P.py draws T = amount% of the n pixels with replacement: T / 2 salt coordinates first, then the others as pepper,
+    which can overwrite the salt. After Ts salt and Tp pepper draws a given pixel is
+        pepper with probability 1 - (1 - 1/n)^Tp
+        salt   with probability (1 - (1 - 1/n)^Ts) (1 - 1/n)^Tp
+    so one random number per pixel compared with two thresholds gives the same distribution of noisy pixels, without any
+    loop over the draws (at amount 90 about 59% of the pixels are changed, as with the script).
+
+------------------------------------------------------------------------------------------------------------------------------------------*/
+
+struct NoiseLevel {
+    int amount;
+    uint64_t key;           // seed of the pixel hashes of this image and amount
+    uint64_t pepper;        // 53-bit random number u < pepper -> black pixel
+    uint64_t saltOrPepper;  // pepper <= u < saltOrPepper -> white pixel, otherwise the pixel is kept
+    cv::Mat out;
+};
+
+// Threshold on a 53-bit uniform integer for the probability p
+static uint64_t threshold(double p) {
+    return (uint64_t)std::ldexp(std::min(std::max(p, 0.0), 1.0), 53);
+}
+
+static NoiseLevel makeLevel(int amount, uint64_t seed, uint64_t imageHash, int R, int C) {
+    double n = (double)R * C;
+    long long total = (long long)(amount / 100.0 * n);   // int() of the script
+    long long numSalt = total / 2;
+    long long numPepper = total - numSalt;
+
+    // (1 - 1/n)^k, probability that k draws all miss a given pixel
+    double logMiss = std::log1p(-1.0 / n);
+    auto miss = [&](long long k) { return k == 0 ? 1.0 : std::exp(k * logMiss); };
+    double pPepper = 1.0 - miss(numPepper);
+    double pSalt = (1.0 - miss(numSalt)) * miss(numPepper);
+
+    NoiseLevel level;
+    level.amount = amount;
+    level.key = mix64(seed ^ mix64(imageHash + (uint64_t)amount));
+    level.pepper = threshold(pPepper);
+    level.saltOrPepper = threshold(pPepper + pSalt);
+    level.out.create(R, C, CV_8UC3);
+    return level;
+}
+
+// Noise of the row: 0 or 255 in noise, 255 in mask where the pixel is replaced. Only 64-bit integer lanes, so it vectorizes
+static void hashRow(const NoiseLevel &level, uint64_t first, int C, unsigned char *noise, unsigned char *mask) {
+    const uint64_t key = level.key, pepper = level.pepper, saltOrPepper = level.saltOrPepper;
+    #pragma omp simd
+    for (int x = 0; x < C; x++) {
+        uint64_t u = mix64(key + (first + (uint64_t)x) * 0x9E3779B97F4A7C15ull) >> 11;
+        noise[x] = u < pepper ? 0 : 255;
+        mask[x] = u < saltOrPepper ? 255 : 0;
+    }
+}
+
+// One pass over the pixels of the image for all the amounts
+static void addNoise(const cv::Mat &image, std::vector<NoiseLevel> &levels) {
+    int R = image.rows;
+    int C = image.cols;
+
+    #pragma omp parallel
+    {
+        std::vector<unsigned char> noise(C), mask(C);
+
+        #pragma omp for schedule(static)
+        for (int y = 0; y < R; y++) {
+            const unsigned char *in = image.ptr<unsigned char>(y);
+            for (NoiseLevel &level : levels) {
+                unsigned char *out = level.out.ptr<unsigned char>(y);
+                hashRow(level, (uint64_t)y * C, C, noise.data(), mask.data());
+                for (int x = 0; x < C; x++) {
+                    for (int c = 0; c < 3; c++) {
+                        out[3 * x + c] = (unsigned char)((in[3 * x + c] & ~mask[x]) | (noise[x] & mask[x]));
+                    }
+                }
+            }
+        }
+    }
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+
+                                                    Pipeline: decode -> noise -> encode (same as Es2 -b)
+
+------------------------------------------------------------------------------------------------------------------------------------------*/
+
+struct NoiseItem {
+    std::string path;
+    cv::Mat image;
+};
+
+int main(int argc, char **argv) {
+    if (argc < 4) {
+        std::cerr << "Usage: " << argv[0] << " <input_directory> <output_root> <amount_percent> [<amount_percent> ...] [-seed N] [-j threads]" << std::endl;
+        return 1;
+    }
+    std::string inputDir = argv[1];
+    std::string outputRoot = argv[2];
+
+    std::vector<int> amounts;
+    uint64_t seed = DEFAULT_SEED;
+    int numThreads = 4;
+    for (int i = 3; i < argc; i++) {
+        std::string option = argv[i];
+        if (option == "-seed" && i + 1 < argc) {
+            seed = std::strtoull(argv[++i], nullptr, 10);
+        } else if (option == "-j" && i + 1 < argc) {
+            numThreads = atoi(argv[++i]);
+            if (numThreads <= 0) {
+                std::cerr << "Error: number of threads must be a positive integer." << std::endl;
+                return 1;
+            }
+        } else {
+            char *end = nullptr;
+            long amount = std::strtol(argv[i], &end, 10);
+            if (*end != '\0' || amount < 0 || amount > 100) {
+                std::cerr << "Error: Amount must be a number between 0 and 100 (got " << option << ")." << std::endl;
+                return 1;
+            }
+            amounts.push_back((int)amount);
+        }
+    }
+    if (amounts.empty()) {
+        std::cerr << "Error: no noise amount given." << std::endl;
+        return 1;
+    }
+    // An amount given twice would write the same files from two encoder threads
+    std::sort(amounts.begin(), amounts.end());
+    amounts.erase(std::unique(amounts.begin(), amounts.end()), amounts.end());
+
+    if (!std::filesystem::is_directory(inputDir)) {
+        std::cerr << "Error: Directory '" << inputDir << "' not found." << std::endl;
+        return 1;
+    }
+    std::vector<std::string> paths = ListImageDirectory(inputDir);
+    for (int amount : amounts) {
+        std::filesystem::create_directories(std::filesystem::path(outputRoot) / ("noise" + std::to_string(amount)));
+    }
+
+    BoundedQueue<NoiseItem> decoded(2 * numThreads);
+    BoundedQueue<NoiseItem> noisy(2 * numThreads * amounts.size());
+    auto start = std::chrono::high_resolution_clock::now();
+
+    // Decode stage
+    std::atomic<size_t> next(0);
+    std::atomic<int> decodersLeft(numThreads);
+    std::vector<std::thread> decoders;
+    for (int t = 0; t < numThreads; t++) {
+        decoders.emplace_back([&] {
+            for (size_t i = next++; i < paths.size(); i = next++) {
+                NoiseItem item;
+                item.path = paths[i];
+                item.image = cv::imread(paths[i], cv::IMREAD_COLOR);
+                if (item.image.empty()) {
+                    std::cerr << "Error: Could not read image file: " << paths[i] << ", skipped" << std::endl;
+                    continue;
+                }
+                decoded.push(std::move(item));
+            }
+            if (--decodersLeft == 0) decoded.close();
+        });
+    }
+
+    // Encode stage
+    std::vector<std::thread> encoders;
+    for (int t = 0; t < numThreads; t++) {
+        encoders.emplace_back([&] {
+            NoiseItem item;
+            while (noisy.pop(item)) {
+                if (!cv::imwrite(item.path, item.image)) {
+                    std::cerr << "Error: Could not save the image " << item.path << std::endl;
+                }
+            }
+        });
+    }
+
+    // Noise stage on this thread, OpenMP over the rows of the image
+    size_t processed = 0;
+    NoiseItem item;
+    while (decoded.pop(item)) {
+        std::string name = std::filesystem::path(item.path).filename().string();
+        std::vector<NoiseLevel> levels;
+        for (int amount : amounts) {
+            levels.push_back(makeLevel(amount, seed, hashName(name), item.image.rows, item.image.cols));
+        }
+        addNoise(item.image, levels);
+
+        for (NoiseLevel &level : levels) {
+            std::string tag = std::to_string(level.amount);
+            NoiseItem out;
+            out.path = (std::filesystem::path(outputRoot) / ("noise" + tag) / ("noisy" + tag + "_" + name)).string();
+            out.image = level.out;
+            noisy.push(std::move(out));
+        }
+        processed++;
+        std::cout << "Processed " << name << " (" << processed << "/" << paths.size() << ")" << std::endl;
+    }
+    noisy.close();
+
+    for (auto &worker : decoders) worker.join();
+    for (auto &worker : encoders) worker.join();
+
+    double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+    std::cout << "Processing complete: " << processed << " images x " << amounts.size() << " amounts in " << seconds
+              << " s (" << omp_get_max_threads() << " noise threads, seed " << seed << ")" << std::endl;
+    return 0;
+}
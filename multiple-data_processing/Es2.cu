@@ -6,9 +6,61 @@
 #include <cuda_runtime.h>
 #include <string> 
 #include <fstream>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <filesystem>
+#include "Es2_cpu.h"
+#include "Es2_queue.h"
+#include "Es2_images.h"
+#include "Es2_stream.h"
 #define TILE_DIM 16  // Block Thread Dimension
 #define HALO_SIZE 1  // Halo size, how much columns/rows of pixels to load around the tile 
                      // 1 because the filter is 3x3
+#define ADAPTIVE_MAX_SIZE 7  // Biggest window of the adaptive median filter
+#define BENCH_RUNS 5         // Timed runs of each filter in benchmark mode (after one warm-up run)
+#define STREAM_STRIP_ROWS 512  // Default rows of a strip in streaming mode
+
+// Engine used to apply the filter, selected at runtime with the -e option
+enum class Engine { CUDA, CPU };
+
+// Filter applied to the image, selected at runtime with the -f option
+enum class Filter { BLUR, MEDIAN3, MEDIAN5, ADAPTIVE_MEDIAN };
+
+// Command line options
+struct Options {
+    Engine engine = Engine::CUDA;
+    Filter filter = Filter::BLUR;
+    bool save = false;      // -s save the result
+    bool check = false;     // -c compare the CPU engine with the scalar reference
+    bool bench = false;     // -bench time every filter on the image
+    bool u8 = false;        // -u8 blur the 8-bit interleaved image directly, without float planes
+    bool stream = false;    // -stream read, blur and write the image in strips (CPU engine, JPEG only)
+    int stripRows = STREAM_STRIP_ROWS;  // -strip rows of a strip in streaming mode
+    int numThreads = 4;     // -j decode/encode threads of the batch mode
+};
+
+// Host and device buffers used to filter one image. In batch mode they are allocated once and reused
+// for all the images: they only grow when an image bigger than all the previous ones arrives
+struct FilterBuffers {
+    size_t capacity = 0;                // pixels per channel the device buffers can hold
+    std::vector<float> channel_host;    // flattened input channels
+    std::vector<float> gxy_host;        // result of the CPU engine, or copy of the device result
+    float *channel = nullptr;           // device input
+    float *gxy = nullptr;               // device output
+    size_t capacity_u8 = 0;             // pixels the 8-bit device buffers can hold (-u8)
+    unsigned char *image_u8 = nullptr;  // device 8-bit interleaved input
+    unsigned char *result_u8 = nullptr; // device 8-bit interleaved output
+    int *maxSum_u8 = nullptr;           // device maximum weighted sum of each channel
+};
+
+void releaseBuffers(FilterBuffers &buffers) {
+    cudaFree(buffers.channel);
+    cudaFree(buffers.gxy);
+    cudaFree(buffers.image_u8);
+    cudaFree(buffers.result_u8);
+    cudaFree(buffers.maxSum_u8);
+}
 
 
 /*----------------------------------------------------------------------------------------------------------------------------------------
@@ -17,22 +69,24 @@
                                                                 
 ------------------------------------------------------------------------------------------------------------------------------------------*/
 
-cv::Mat createG_x_y_Matrix(int channelId, float* gxy, int C, int R){
-    
+// normalize = true stretches the channel to [0, 255]: needed by the blur, whose weights add up to 18/16.
+// The median filters already give pixel values in [0, 255] and are only converted
+cv::Mat createG_x_y_MatrixHost(int channelId, float* gxy_host, int C, int R, bool normalize){
+
     cv::Mat gxy_cpu, tempMat;
     cv::Mat gxy_normalized, gxy_8U;
-    std::vector<float> temp(3 * R * C);
 
-    //copy all the channels from device to host
-    cudaMemcpy(temp.data(), gxy, 3 * R * C * sizeof(float), cudaMemcpyDeviceToHost);
-    
-    // Choose the right channel from the temp vector
-    tempMat = cv::Mat(R, C, CV_32F, temp.data() + channelId  * R * C);
+    // Choose the right channel from the host vector
+    tempMat = cv::Mat(R, C, CV_32F, gxy_host + channelId  * R * C);
     gxy_cpu = tempMat.clone();
 
-    // Normalize the matrix to the range [0, 255] and convert to CV_8U for visualization
-    cv::normalize(gxy_cpu, gxy_normalized, 0, 255, cv::NORM_MINMAX);
-    gxy_normalized.convertTo(gxy_8U, CV_8U);
+    if (normalize) {
+        // Normalize the matrix to the range [0, 255] and convert to CV_8U for visualization
+        cv::normalize(gxy_cpu, gxy_normalized, 0, 255, cv::NORM_MINMAX);
+        gxy_normalized.convertTo(gxy_8U, CV_8U);
+    } else {
+        gxy_cpu.convertTo(gxy_8U, CV_8U);
+    }
     
     return gxy_8U;
 }
@@ -168,6 +222,342 @@ __global__ void g_x_y_calculation(float *channel, float *gxy, int R, int CO){
 }
 
 
+/* ----------------------------------------------------------------------------------------------------------------------------------------
+
+                                                        CUDA Kernels for the median filters
+
+    One thread per output pixel, the border pixels are replicated outside the image (same as the CPU engine)
+
+------------------------------------------------------------------------------------------------------------------------------------------*/
+
+// Load the window of the given radius around (y, x)
+__device__ int loadWindowDevice(const float *in, int R, int CO, int y, int x, int radius, float *w) {
+    int n = 0;
+    for (int dy = -radius; dy <= radius; dy++) {
+        int yy = min(max(y + dy, 0), R - 1);
+        for (int dx = -radius; dx <= radius; dx++) {
+            int xx = min(max(x + dx, 0), CO - 1);
+            w[n++] = in[yy * CO + xx];
+        }
+    }
+    return n;
+}
+
+// Median of the n values of the window: selection sort stopped at the middle element
+__device__ float medianOfWindow(float *w, int n) {
+    for (int i = 0; i <= n / 2; i++) {
+        int m = i;
+        for (int j = i + 1; j < n; j++) {
+            if (w[j] < w[m]) m = j;
+        }
+        float t = w[i];
+        w[i] = w[m];
+        w[m] = t;
+    }
+    return w[n / 2];
+}
+
+__global__ void median_calculation(float *channel, float *out, int R, int CO, int radius) {
+    int x = blockIdx.x * TILE_DIM + threadIdx.x;
+    int y = blockIdx.y * TILE_DIM + threadIdx.y;
+    int z = blockIdx.z;
+    if (x >= CO || y >= R) return;
+
+    float w[25];
+    int n = loadWindowDevice(channel + z * (R * CO), R, CO, y, x, radius, w);
+    out[z * (R * CO) + y * CO + x] = medianOfWindow(w, n);
+}
+
+// Adaptive median: grow the window until its median is not an impulse, then keep the pixel
+// if it is not an impulse itself, otherwise replace it with the median
+__global__ void adaptive_median_calculation(float *channel, float *out, int R, int CO, int maxRadius) {
+    int x = blockIdx.x * TILE_DIM + threadIdx.x;
+    int y = blockIdx.y * TILE_DIM + threadIdx.y;
+    int z = blockIdx.z;
+    if (x >= CO || y >= R) return;
+
+    float w[ADAPTIVE_MAX_SIZE * ADAPTIVE_MAX_SIZE];
+    float zxy = channel[z * (R * CO) + y * CO + x];
+    float result = zxy;
+    for (int radius = 1; radius <= maxRadius; radius++) {
+        int n = loadWindowDevice(channel + z * (R * CO), R, CO, y, x, radius, w);
+        float zmin = w[0], zmax = w[0];
+        for (int i = 1; i < n; i++) {
+            zmin = fminf(zmin, w[i]);
+            zmax = fmaxf(zmax, w[i]);
+        }
+        float zmed = medianOfWindow(w, n);
+        result = zmed;
+        if (zmin < zmed && zmed < zmax) {
+            if (zmin < zxy && zxy < zmax) result = zxy;
+            break;
+        }
+    }
+    out[z * (R * CO) + y * CO + x] = result;
+}
+
+/* ----------------------------------------------------------------------------------------------------------------------------------------
+
+                                                CUDA Kernels for the 8-bit interleaved path (-u8)
+
+    Same two passes as g_x_y_calculation_u8_cpu: the maximum weighted sum of each channel first, then the sums scaled
+    to [0, 255] with the same fixed point formula, so that both engines give the same bytes
+
+------------------------------------------------------------------------------------------------------------------------------------------*/
+
+// Integer weighted sum (x16) of channel c around the interior pixel (y, x)
+__device__ int weightedSumU8(const unsigned char *img, size_t pitch, int y, int x, int c) {
+    const unsigned char *up = img + (size_t)(y - 1) * pitch + x * 3 + c;
+    const unsigned char *mid = up + pitch;
+    const unsigned char *down = mid + pitch;
+    return (up[-3] + 2 * up[0] + up[3]) + (3 * mid[-3] + 4 * mid[0] + 3 * mid[3]) + (down[-3] + 2 * down[0] + down[3]);
+}
+
+__global__ void g_x_y_max_u8(const unsigned char *img, size_t pitch, int R, int CO, int *maxSum) {
+    __shared__ int blockMax[3];
+    int tid = threadIdx.y * TILE_DIM + threadIdx.x;
+    if (tid < 3) blockMax[tid] = 0;
+    __syncthreads();
+
+    int x = blockIdx.x * TILE_DIM + threadIdx.x;
+    int y = blockIdx.y * TILE_DIM + threadIdx.y;
+    if (x >= 1 && x < CO - 1 && y >= 1 && y < R - 1) {
+        for (int c = 0; c < 3; c++) atomicMax(&blockMax[c], weightedSumU8(img, pitch, y, x, c));
+    }
+
+    // One global atomic per block and channel
+    __syncthreads();
+    if (tid < 3) atomicMax(&maxSum[tid], blockMax[tid]);
+}
+
+__global__ void g_x_y_calculation_u8(const unsigned char *img, size_t pitch, unsigned char *out, size_t outPitch,
+                                     int R, int CO, const int *maxSum) {
+    // round(255 * sum / max sum) = (sum * scale + 2^24) >> 25 in 64 bits, scale computed once per block
+    __shared__ unsigned long long scale[3];
+    int tid = threadIdx.y * TILE_DIM + threadIdx.x;
+    if (tid < 3) {
+        unsigned long long m = maxSum[tid];
+        scale[tid] = m == 0 ? 0 : ((2ull * 255 << U8_SCALE_BITS) + m) / (2ull * m);
+    }
+    __syncthreads();
+
+    int x = blockIdx.x * TILE_DIM + threadIdx.x;
+    int y = blockIdx.y * TILE_DIM + threadIdx.y;
+    if (x >= CO || y >= R) return;
+
+    bool border = x == 0 || x >= CO - 1 || y == 0 || y >= R - 1;
+    for (int c = 0; c < 3; c++) {
+        unsigned long long value = border ? 0 : ((unsigned long long)weightedSumU8(img, pitch, y, x, c) * scale[c] + (1ull << (U8_SCALE_BITS - 1))) >> U8_SCALE_BITS;
+        out[(size_t)y * outPitch + x * 3 + c] = (unsigned char)value;
+    }
+}
+
+/* ----------------------------------------------------------------------------------------------------------------------------------------------
+
+                                                        Dispatch of the selected filter on the two engines
+
+    ------------------------------------------------------------------------------------------------------------------------------------------------*/
+
+void launchFilterCUDA(Filter filter, float *channel, float *gxy, int R, int C, dim3 numBlocks, dim3 threadsPerBlock) {
+    switch (filter) {
+        case Filter::BLUR:
+            g_x_y_calculation<<<numBlocks, threadsPerBlock>>>(channel, gxy, R, C);
+            break;
+        case Filter::MEDIAN3:
+            median_calculation<<<numBlocks, threadsPerBlock>>>(channel, gxy, R, C, 1);
+            break;
+        case Filter::MEDIAN5:
+            median_calculation<<<numBlocks, threadsPerBlock>>>(channel, gxy, R, C, 2);
+            break;
+        case Filter::ADAPTIVE_MEDIAN:
+            adaptive_median_calculation<<<numBlocks, threadsPerBlock>>>(channel, gxy, R, C, ADAPTIVE_MAX_SIZE / 2);
+            break;
+    }
+}
+
+// reference = true runs the plain scalar version of the filter instead of the engine
+void applyFilterCPU(Filter filter, const float *channel, float *gxy, int R, int C, bool reference) {
+    switch (filter) {
+        case Filter::BLUR:
+            if (reference) g_x_y_calculation_reference(channel, gxy, R, C, 3);
+            else g_x_y_calculation_cpu(channel, gxy, R, C, 3);
+            break;
+        case Filter::MEDIAN3:
+        case Filter::MEDIAN5: {
+            int size = filter == Filter::MEDIAN3 ? 3 : 5;
+            if (reference) median_calculation_reference(channel, gxy, R, C, 3, size);
+            else median_calculation_cpu(channel, gxy, R, C, 3, size);
+            break;
+        }
+        case Filter::ADAPTIVE_MEDIAN:
+            if (reference) adaptive_median_calculation_reference(channel, gxy, R, C, 3, ADAPTIVE_MAX_SIZE);
+            else adaptive_median_calculation_cpu(channel, gxy, R, C, 3, ADAPTIVE_MAX_SIZE);
+            break;
+    }
+}
+
+// Convert the channels to CV_32F and flat them into a single vector, one channel after the other
+void flattenChannels(const std::vector<cv::Mat> &channels, std::vector<float> &channel_host) {
+    size_t pixels = (size_t)channels[0].rows * channels[0].cols;
+    channel_host.resize(3 * pixels);
+    cv::Mat ch32;
+    for (int i = 0; i < 3; i++) {
+        channels[i].convertTo(ch32, CV_32F);
+        std::memcpy(channel_host.data() + i * pixels, ch32.ptr<float>(), pixels * sizeof(float));
+    }
+}
+
+/* ----------------------------------------------------------------------------------------------------------------------------------------------
+
+                                                        Function to process the image on the CPU engine
+
+    ------------------------------------------------------------------------------------------------------------------------------------------------*/
+
+cv::Mat GetResultCPU(FilterBuffers &buffers, int R, int C, std::chrono::high_resolution_clock::time_point start,
+                     const Options &options, std::ofstream &logFile) {
+    std::vector<float> &channel_host = buffers.channel_host;
+    std::vector<float> &gxy_host = buffers.gxy_host;
+    gxy_host.resize(3 * R * C);
+
+    // Apply the filter on the three channels
+    auto kernel_start = std::chrono::high_resolution_clock::now();
+    applyFilterCPU(options.filter, channel_host.data(), gxy_host.data(), R, C, false);
+    auto kernel_end = std::chrono::high_resolution_clock::now();
+
+    float milliseconds = std::chrono::duration<float, std::milli>(kernel_end - kernel_start).count();
+    logFile << std::to_string(milliseconds) << ";";
+
+    // Compare with the scalar reference, the pixels must be exactly the same
+    if (options.check) {
+        std::vector<float> gxy_ref(3 * R * C);
+        applyFilterCPU(options.filter, channel_host.data(), gxy_ref.data(), R, C, true);
+        long mismatches = 0;
+        for (size_t i = 0; i < gxy_ref.size(); i++) {
+            if (gxy_host[i] != gxy_ref[i]) mismatches++;
+        }
+        std::cout << "CPU engine (" << cpuSimdName() << ", " << cpuThreadCount() << " threads) vs scalar reference: "
+                  << mismatches << " different values" << std::endl;
+        if (mismatches != 0) {
+            std::cerr << "Error: CPU engine result differs from the scalar reference!" << std::endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // Create the gxy matrices for each channel
+    cv::Mat Redgxy = createG_x_y_MatrixHost(2, gxy_host.data(), C, R, options.filter == Filter::BLUR);
+    cv::Mat Greengxy = createG_x_y_MatrixHost(1, gxy_host.data(), C, R, options.filter == Filter::BLUR);
+    cv::Mat Bluegxy = createG_x_y_MatrixHost(0, gxy_host.data(), C, R, options.filter == Filter::BLUR);
+
+    //end the timer
+    auto end = std::chrono::high_resolution_clock::now();
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+    logFile << std::to_string(elapsed) << "\n";
+    //Recombine the image
+    cv::Mat gxyResult;
+    cv::merge(std::vector<cv::Mat>{Bluegxy, Greengxy, Redgxy}, gxyResult);
+
+    return gxyResult;
+}
+
+/* ----------------------------------------------------------------------------------------------------------------------------------------------
+
+                                        Function to blur the 8-bit interleaved image directly (-u8 option)
+
+    No split, no float planes and no normalize/convertTo/merge: the engines read the cv::Mat given by imread and write the
+    normalized result straight into the output cv::Mat
+
+    ------------------------------------------------------------------------------------------------------------------------------------------------*/
+
+// Upload, both kernels and download of the -u8 blur on the device, returns the time of the kernels
+float blurU8CUDA(const cv::Mat &image, cv::Mat &result, FilterBuffers &buffers) {
+    int R = image.rows;
+    int C = image.cols;
+
+    // Device buffers are packed (pitch 3 * C), the cv::Mat rows may be padded
+    size_t rowBytes = (size_t)C * 3;
+    size_t pixels = (size_t)R * C;
+    if (pixels > buffers.capacity_u8) {
+        cudaFree(buffers.image_u8);
+        cudaFree(buffers.result_u8);
+        cudaMalloc(&buffers.image_u8, 3 * pixels);
+        cudaMalloc(&buffers.result_u8, 3 * pixels);
+        buffers.capacity_u8 = pixels;
+    }
+    if (buffers.maxSum_u8 == nullptr) cudaMalloc(&buffers.maxSum_u8, 3 * sizeof(int));
+
+    cudaMemcpy2D(buffers.image_u8, rowBytes, image.ptr<unsigned char>(), image.step, rowBytes, R, cudaMemcpyHostToDevice);
+    cudaMemset(buffers.maxSum_u8, 0, 3 * sizeof(int));
+
+    dim3 threadsPerBlock(TILE_DIM, TILE_DIM);
+    dim3 numBlocks((C + TILE_DIM - 1) / TILE_DIM, (R + TILE_DIM - 1) / TILE_DIM);
+    cudaEvent_t start_event, stop_event;
+    cudaEventCreate(&start_event);
+    cudaEventCreate(&stop_event);
+
+    cudaEventRecord(start_event);
+    g_x_y_max_u8<<<numBlocks, threadsPerBlock>>>(buffers.image_u8, rowBytes, R, C, buffers.maxSum_u8);
+    g_x_y_calculation_u8<<<numBlocks, threadsPerBlock>>>(buffers.image_u8, rowBytes, buffers.result_u8, rowBytes, R, C, buffers.maxSum_u8);
+    cudaEventRecord(stop_event);
+    cudaEventSynchronize(stop_event);
+
+    float milliseconds = 0;
+    cudaEventElapsedTime(&milliseconds, start_event, stop_event);
+    cudaEventDestroy(start_event);
+    cudaEventDestroy(stop_event);
+
+    cudaMemcpy2D(result.ptr<unsigned char>(), result.step, buffers.result_u8, rowBytes, rowBytes, R, cudaMemcpyDeviceToHost);
+    return milliseconds;
+}
+
+cv::Mat FilterImageU8(const cv::Mat &image, const Options &options, FilterBuffers &buffers, std::ofstream &logFile) {
+    int R = image.rows;
+    int C = image.cols;
+    logFile << std::to_string(R) << ";" << std::to_string(C) << ";";
+
+    auto start = std::chrono::high_resolution_clock::now();
+    logFile << (options.engine == Engine::CPU ? cpuThreadCount() : TILE_DIM * TILE_DIM) << ";";
+
+    cv::Mat result(R, C, CV_8UC3);
+    float milliseconds = 0;
+
+    if (options.engine == Engine::CPU) {
+        auto kernel_start = std::chrono::high_resolution_clock::now();
+        g_x_y_calculation_u8_cpu(image.ptr<unsigned char>(), image.step, result.ptr<unsigned char>(), result.step, R, C, 3);
+        auto kernel_end = std::chrono::high_resolution_clock::now();
+        milliseconds = std::chrono::duration<float, std::milli>(kernel_end - kernel_start).count();
+
+        // Compare with the scalar reference, the bytes must be exactly the same
+        if (options.check) {
+            cv::Mat reference(R, C, CV_8UC3);
+            g_x_y_calculation_u8_reference(image.ptr<unsigned char>(), image.step, reference.ptr<unsigned char>(), reference.step, R, C, 3);
+            long mismatches = 0;
+            for (int y = 0; y < R; y++) {
+                const unsigned char *a = result.ptr<unsigned char>(y);
+                const unsigned char *b = reference.ptr<unsigned char>(y);
+                for (int i = 0; i < 3 * C; i++) {
+                    if (a[i] != b[i]) mismatches++;
+                }
+            }
+            std::cout << "CPU engine u8 (" << cpuSimdName() << ", " << cpuThreadCount() << " threads) vs scalar reference: "
+                      << mismatches << " different values" << std::endl;
+            if (mismatches != 0) {
+                std::cerr << "Error: CPU engine result differs from the scalar reference!" << std::endl;
+                exit(EXIT_FAILURE);
+            }
+        }
+    } else {
+        milliseconds = blurU8CUDA(image, result, buffers);
+    }
+    logFile << std::to_string(milliseconds) << ";";
+
+    //end the timer
+    auto end = std::chrono::high_resolution_clock::now();
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+    logFile << std::to_string(elapsed) << "\n";
+
+    return result;
+}
+
 /* ----------------------------------------------------------------------------------------------------------------------------------------------
     
                                                                 Function to process the image
@@ -176,24 +566,22 @@ __global__ void g_x_y_calculation(float *channel, float *gxy, int R, int CO){
 
 
 
-cv::Mat GetResult(std::string imagePath, std::ofstream &logFile) {
+cv::Mat FilterImage(const cv::Mat &image, const Options &options, FilterBuffers &buffers, std::ofstream &logFile) {
+    // 8-bit interleaved path: none of the float setup below is needed
+    if (options.u8) {
+        return FilterImageU8(image, options, buffers, logFile);
+    }
+
     /* ----------------------------------------------------------------------------------------------------------------------------------------------
     
                                                                         OpenCV Setup
 
     ------------------------------------------------------------------------------------------------------------------------------------------------*/
     
-    //Read the Image
-    cv::Mat image = cv::imread(imagePath, cv::IMREAD_COLOR);
-
-    // Decomposition of the image into its RGB channels
-    if(image.empty()) {
-        std::cerr << "Error: Could not open or find the image!" << std::endl;
-        exit(EXIT_FAILURE);
-    }  
     //image size
     logFile << std::to_string(image.rows) << ";" << std::to_string(image.cols) << ";";
 
+    // Decomposition of the image into its RGB channels
     std::vector<cv::Mat> channels;
     cv::split(image, channels);
 
@@ -207,26 +595,16 @@ cv::Mat GetResult(std::string imagePath, std::ofstream &logFile) {
     auto start = std::chrono::high_resolution_clock::now();
     // get the number of threads from the environment variable
     //std::cout << "Thread used: " << TILE_DIM * TILE_DIM << std::endl;
-    logFile << TILE_DIM * TILE_DIM << ";";
-    // instatiate cv matrix from which you will get the data to be stored in CUDA memory
-    std::vector<cv::Mat> ch32(3);
-    std::vector<float> channel_host(3 * channels[0].rows * channels[0].cols);    
+    logFile << (options.engine == Engine::CPU ? cpuThreadCount() : TILE_DIM * TILE_DIM) << ";";
 
     // Convert the channels to CV_32F for CUDA processing and Flat the channels into a single vector
-    for (int i = 0; i < 3; i++) {        
-        // create a matrix to hold the channel data converted to CV_32F
-        channels[i].convertTo(ch32[i], CV_32F);
-        std::memcpy(
-            channel_host.data() + i * channels[0].rows * channels[0].cols,
-            ch32[i].ptr<float>(),
-            channels[0].rows * channels[0].cols * sizeof(float)
-        );
-    }
-    // Initialize the gxy vector with zeros
-    std::vector<float> gxy_channels(3 * channels[0].rows * channels[0].cols, 0.0f);
-    
-    // Allocate memory for the channels (data as input) and gxy (data processed) on the device
-    float *channel, *gxy;
+    std::vector<float> &channel_host = buffers.channel_host;
+    flattenChannels(channels, channel_host);
+
+    // GPU-less nodes: same filter on the CPU engine
+    if (options.engine == Engine::CPU) {
+        return GetResultCPU(buffers, channels[0].rows, channels[0].cols, start, options, logFile);
+    }
 
     // Define the number of threads per block and the number of blocks
     dim3 threadsPerBlock(TILE_DIM, TILE_DIM);
@@ -236,14 +614,20 @@ cv::Mat GetResult(std::string imagePath, std::ofstream &logFile) {
         3 // 3 channels (R, G, B)
     );
     
-    // Allocate memory on the device for the channels and gxy
-    cudaMalloc(&channel, 3 * channels[0].rows * channels[0].cols * sizeof(float));
-    cudaMalloc(&gxy, 3 * channels[0].rows * channels[0].cols * sizeof(float));
+    // Allocate memory on the device for the channels and gxy, unless the buffers of the previous image are big enough
+    size_t pixels = (size_t)channels[0].rows * channels[0].cols;
+    if (pixels > buffers.capacity) {
+        cudaFree(buffers.channel);
+        cudaFree(buffers.gxy);
+        cudaMalloc(&buffers.channel, 3 * pixels * sizeof(float));
+        cudaMalloc(&buffers.gxy, 3 * pixels * sizeof(float));
+        buffers.capacity = pixels;
+    }
+    float *channel = buffers.channel;
+    float *gxy = buffers.gxy;
 
-    // copy the data from the image
+    // copy the data from the image (gxy needs no initialization, the kernels write every pixel)
     cudaMemcpy(channel, channel_host.data(), 3 * channels[0].rows * channels[0].cols * sizeof(float), cudaMemcpyHostToDevice);
-    // copy the all 0s matrix that host the processed data
-    cudaMemcpy(gxy, gxy_channels.data(), 3 * channels[0].rows * channels[0].cols * sizeof(float), cudaMemcpyHostToDevice);
     //time measurement
     cudaEvent_t start_event, stop_event;
     cudaEventCreate(&start_event);
@@ -251,7 +635,7 @@ cv::Mat GetResult(std::string imagePath, std::ofstream &logFile) {
 
     // Launch the kernel to calculate gxy for each channel
     cudaEventRecord(start_event);
-    g_x_y_calculation<<<numBlocks, threadsPerBlock>>>(channel, gxy, channels[0].rows, channels[0].cols);
+    launchFilterCUDA(options.filter, channel, gxy, channels[0].rows, channels[0].cols, numBlocks, threadsPerBlock);
     cudaEventRecord(stop_event);
     cudaEventSynchronize(stop_event);
 
@@ -280,22 +664,23 @@ cv::Mat GetResult(std::string imagePath, std::ofstream &logFile) {
 
 
     //                                                     Create the gxy matrices for each channel
-    
+
+    // copy all the channels from device to host, once for the three channels
+    std::vector<float> &gxy_host = buffers.gxy_host;
+    gxy_host.resize(3 * pixels);
+    cudaMemcpy(gxy_host.data(), gxy, 3 * pixels * sizeof(float), cudaMemcpyDeviceToHost);
+
     //Red Channel
     //std::cout << "Red channel " << std::endl;
-    cv::Mat Redgxy = createG_x_y_Matrix(2, gxy, channels[2].cols, channels[2].rows);
+    cv::Mat Redgxy = createG_x_y_MatrixHost(2, gxy_host.data(), channels[2].cols, channels[2].rows, options.filter == Filter::BLUR);
 
     //Green Channel
     //std::cout << "Green channel " << std::endl;
-    cv::Mat Greengxy = createG_x_y_Matrix(1, gxy, channels[1].cols, channels[1].rows);
+    cv::Mat Greengxy = createG_x_y_MatrixHost(1, gxy_host.data(), channels[1].cols, channels[1].rows, options.filter == Filter::BLUR);
     
     //Blue Channel
     //std::cout << "Blue channel " << std::endl;
-    cv::Mat Bluegxy = createG_x_y_Matrix(0, gxy, channels[0].cols, channels[0].rows);
-      
-    // Cuda free the memory
-    cudaFree(channel);
-    cudaFree(gxy);
+    cv::Mat Bluegxy = createG_x_y_MatrixHost(0, gxy_host.data(), channels[0].cols, channels[0].rows, options.filter == Filter::BLUR);
 
     //end the timer
     auto end = std::chrono::high_resolution_clock::now();
@@ -310,6 +695,263 @@ cv::Mat GetResult(std::string imagePath, std::ofstream &logFile) {
     return gxyResult;
 }
 
+cv::Mat GetResult(std::string imagePath, const Options &options, std::ofstream &logFile) {
+    //Read the Image
+    cv::Mat image = cv::imread(imagePath, cv::IMREAD_COLOR);
+    if(image.empty()) {
+        std::cerr << "Error: Could not open or find the image!" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    FilterBuffers buffers;
+    cv::Mat result = FilterImage(image, options, buffers, logFile);
+
+    // Cuda free the memory
+    releaseBuffers(buffers);
+
+    return result;
+}
+
+/* ----------------------------------------------------------------------------------------------------------------------------------------------
+
+                                                    Batch mode: decode -> filter -> encode pipeline in one process
+
+    ------------------------------------------------------------------------------------------------------------------------------------------------*/
+
+// Image travelling through the pipeline
+struct BatchItem {
+    std::string path;
+    cv::Mat image;
+};
+
+// List of the images to process: every image file of a directory, or one path per line of a text file
+std::vector<std::string> ListImages(const std::string &input) {
+    std::vector<std::string> paths;
+    if (std::filesystem::is_directory(input)) {
+        paths = ListImageDirectory(input);
+    } else {
+        std::ifstream list(input);
+        if (!list) {
+            std::cerr << "Error: " << input << " is neither a directory nor a readable file list!" << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        std::string line;
+        while (std::getline(list, line)) {
+            if (!line.empty()) paths.push_back(line);
+        }
+    }
+    return paths;
+}
+
+void RunBatch(const std::string &input, const std::string &outputDir, const Options &options, std::ofstream &logFile) {
+    const bool save = options.save;
+    const int numThreads = options.numThreads;
+    std::vector<std::string> paths = ListImages(input);
+    if (paths.empty()) {
+        std::cerr << "Error: no images found in " << input << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    if (save) std::filesystem::create_directories(outputDir);
+
+    // At most two images per worker wait in each queue: this bounds the memory used by the pipeline
+    BoundedQueue<BatchItem> decoded(2 * numThreads);
+    BoundedQueue<BatchItem> filtered(2 * numThreads);
+
+    // Time spent in each stage, one slot per worker so that no locking is needed
+    std::vector<double> decodeMs(numThreads, 0.0), encodeMs(numThreads, 0.0);
+    double filterMs = 0.0;
+    size_t processed = 0;
+
+    auto start = std::chrono::high_resolution_clock::now();
+
+    // Decode stage: the workers take the next image to read from a shared counter
+    std::atomic<size_t> next(0);
+    std::atomic<int> decodersLeft(numThreads);
+    std::vector<std::thread> decoders;
+    for (int t = 0; t < numThreads; t++) {
+        decoders.emplace_back([&, t] {
+            for (size_t i = next++; i < paths.size(); i = next++) {
+                auto t0 = std::chrono::high_resolution_clock::now();
+                BatchItem item;
+                item.path = paths[i];
+                item.image = cv::imread(paths[i], cv::IMREAD_COLOR);
+                if (item.image.empty()) {
+                    std::cerr << "Error: Could not open or find the image " << paths[i] << ", skipped" << std::endl;
+                    continue;
+                }
+                decodeMs[t] += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - t0).count();
+                decoded.push(std::move(item));
+            }
+            // The last decoder to finish tells the filter stage that no more images will come
+            if (--decodersLeft == 0) decoded.close();
+        });
+    }
+
+    // Encode stage, only when the results have to be saved
+    std::vector<std::thread> encoders;
+    if (save) {
+        for (int t = 0; t < numThreads; t++) {
+            encoders.emplace_back([&, t] {
+                BatchItem item;
+                while (filtered.pop(item)) {
+                    auto t0 = std::chrono::high_resolution_clock::now();
+                    if (!cv::imwrite(item.path, item.image)) {
+                        std::cerr << "Error: Could not save the image " << item.path << std::endl;
+                    }
+                    encodeMs[t] += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - t0).count();
+                }
+            });
+        }
+    }
+
+    // Filter stage on this thread: the same buffers (and CUDA context) are used for the whole batch
+    FilterBuffers buffers;
+    BatchItem item;
+    while (decoded.pop(item)) {
+        auto t0 = std::chrono::high_resolution_clock::now();
+        logFile << item.path << ";";
+        cv::Mat result = FilterImage(item.image, options, buffers, logFile);
+        filterMs += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - t0).count();
+        processed++;
+
+        if (save) {
+            BatchItem out;
+            out.path = (std::filesystem::path(outputDir) / ("BLUR" + std::filesystem::path(item.path).filename().string())).string();
+            out.image = result;
+            filtered.push(std::move(out));
+        }
+    }
+    filtered.close();
+
+    for (auto &worker : decoders) worker.join();
+    for (auto &worker : encoders) worker.join();
+
+    // Cuda free the memory
+    releaseBuffers(buffers);
+
+    auto end = std::chrono::high_resolution_clock::now();
+    double seconds = std::chrono::duration<double>(end - start).count();
+
+    // Throughput and average latency of each stage
+    double decodeTotal = 0.0, encodeTotal = 0.0;
+    for (int t = 0; t < numThreads; t++) {
+        decodeTotal += decodeMs[t];
+        encodeTotal += encodeMs[t];
+    }
+    double imagesPerSecond = processed / seconds;
+    double decodeAvg = processed ? decodeTotal / processed : 0.0;
+    double filterAvg = processed ? filterMs / processed : 0.0;
+    double encodeAvg = processed ? encodeTotal / processed : 0.0;
+
+    logFile << "BATCH;" << processed << ";" << std::to_string(seconds) << ";" << std::to_string(imagesPerSecond) << ";"
+            << std::to_string(decodeAvg) << ";" << std::to_string(filterAvg) << ";" << std::to_string(encodeAvg) << "\n";
+    std::cout << "Processed " << processed << " images in " << seconds << " s (" << imagesPerSecond << " images/s)" << std::endl;
+    std::cout << "Average latency [ms]: decode " << decodeAvg << ", filter " << filterAvg << ", encode " << encodeAvg << std::endl;
+}
+
+/* ----------------------------------------------------------------------------------------------------------------------------------------------
+
+                                                    Benchmark mode: time of every filter per megapixel
+
+    ------------------------------------------------------------------------------------------------------------------------------------------------*/
+
+void BenchmarkFilters(const std::string &imagePath, const Options &options, std::ofstream &logFile) {
+    cv::Mat image = cv::imread(imagePath, cv::IMREAD_COLOR);
+    if(image.empty()) {
+        std::cerr << "Error: Could not open or find the image!" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    int R = image.rows;
+    int C = image.cols;
+    double megapixels = (double)R * C / 1e6;
+
+    std::vector<cv::Mat> channels;
+    cv::split(image, channels);
+    std::vector<float> channel_host;
+    flattenChannels(channels, channel_host);
+    std::vector<float> gxy_host(3 * (size_t)R * C);
+
+    // Device buffers, allocated once for all the filters
+    float *channel = nullptr, *gxy = nullptr;
+    dim3 threadsPerBlock(TILE_DIM, TILE_DIM);
+    dim3 numBlocks((C + TILE_DIM - 1) / TILE_DIM, (R + TILE_DIM - 1) / TILE_DIM, 3);
+    cudaEvent_t start_event, stop_event;
+    if (options.engine == Engine::CUDA) {
+        cudaMalloc(&channel, 3 * (size_t)R * C * sizeof(float));
+        cudaMalloc(&gxy, 3 * (size_t)R * C * sizeof(float));
+        cudaMemcpy(channel, channel_host.data(), 3 * (size_t)R * C * sizeof(float), cudaMemcpyHostToDevice);
+        cudaEventCreate(&start_event);
+        cudaEventCreate(&stop_event);
+    }
+
+    const Filter filters[] = {Filter::BLUR, Filter::MEDIAN3, Filter::MEDIAN5, Filter::ADAPTIVE_MEDIAN};
+    const char *names[] = {"blur", "median3", "median5", "amedian"};
+    const char *engineName = options.engine == Engine::CUDA ? "cuda" : "cpu";
+    std::cout << "Benchmark of " << imagePath << " (" << R << "x" << C << ") on the " << engineName << " engine" << std::endl;
+    logFile << "BENCH;" << imagePath << ";" << engineName << ";" << R << ";" << C;
+
+    double blurPerMP = 0.0;
+    for (int f = 0; f < 4; f++) {
+        // Best of BENCH_RUNS runs, the first run is a warm-up
+        float best = 0.0f;
+        for (int run = 0; run <= BENCH_RUNS; run++) {
+            float milliseconds = 0.0f;
+            if (options.engine == Engine::CUDA) {
+                cudaEventRecord(start_event);
+                launchFilterCUDA(filters[f], channel, gxy, R, C, numBlocks, threadsPerBlock);
+                cudaEventRecord(stop_event);
+                cudaEventSynchronize(stop_event);
+                cudaEventElapsedTime(&milliseconds, start_event, stop_event);
+            } else {
+                auto t0 = std::chrono::high_resolution_clock::now();
+                applyFilterCPU(filters[f], channel_host.data(), gxy_host.data(), R, C, false);
+                milliseconds = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - t0).count();
+            }
+            if (run == 1 || (run > 1 && milliseconds < best)) best = milliseconds;
+        }
+
+        double perMP = best / megapixels;
+        if (filters[f] == Filter::BLUR) blurPerMP = perMP;
+        std::cout << "  " << names[f] << ": " << best << " ms, " << perMP << " ms/MP";
+        if (filters[f] != Filter::BLUR && blurPerMP > 0.0) std::cout << " (" << perMP / blurPerMP << "x blur)";
+        std::cout << std::endl;
+        logFile << ";" << std::to_string(perMP);
+    }
+
+    // Blur on the 8-bit interleaved image (-u8), kernels only as above
+    {
+        cv::Mat result(R, C, CV_8UC3);
+        FilterBuffers buffers;
+        float best = 0.0f;
+        for (int run = 0; run <= BENCH_RUNS; run++) {
+            float milliseconds = 0.0f;
+            if (options.engine == Engine::CUDA) {
+                milliseconds = blurU8CUDA(image, result, buffers);
+            } else {
+                auto t0 = std::chrono::high_resolution_clock::now();
+                g_x_y_calculation_u8_cpu(image.ptr<unsigned char>(), image.step, result.ptr<unsigned char>(), result.step, R, C, 3);
+                milliseconds = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - t0).count();
+            }
+            if (run == 1 || (run > 1 && milliseconds < best)) best = milliseconds;
+        }
+        releaseBuffers(buffers);
+
+        double perMP = best / megapixels;
+        std::cout << "  blur_u8: " << best << " ms, " << perMP << " ms/MP";
+        if (blurPerMP > 0.0) std::cout << " (" << perMP / blurPerMP << "x blur)";
+        std::cout << std::endl;
+        logFile << ";" << std::to_string(perMP);
+    }
+    logFile << "\n";
+
+    if (options.engine == Engine::CUDA) {
+        cudaEventDestroy(start_event);
+        cudaEventDestroy(stop_event);
+        cudaFree(channel);
+        cudaFree(gxy);
+    }
+}
+
 /* ----------------------------------------------------------------------------------------------------------------------------------------------
     
                                                                     Main Function
@@ -317,6 +959,16 @@ cv::Mat GetResult(std::string imagePath, std::ofstream &logFile) {
     ------------------------------------------------------------------------------------------------------------------------------------------------*/
 
 int main(int argc, char** argv) {
+    // Batch mode: Es2 -b <input_directory|file_list> <output_directory> [options]
+    bool batch = argc > 1 && argv[1] == std::string("-b");
+    int firstArg = batch ? 2 : 1;
+    if (argc < firstArg + 2) {
+        std::cerr << "Usage: " << argv[0] << " <input_image> <output_image> [-s] [-e cuda|cpu] [-f blur|median3|median5|amedian] [-u8] [-c] [-bench]" << std::endl;
+        std::cerr << "       " << argv[0] << " <input_image.jpg> <output_image.jpg> -stream [-strip rows]" << std::endl;
+        std::cerr << "       " << argv[0] << " -b <input_directory|file_list> <output_directory> [-s] [-e cuda|cpu] [-f filter] [-u8] [-c] [-j threads]" << std::endl;
+        return 1;
+    }
+
     int deviceCount = 0;
     cudaGetDeviceCount(&deviceCount);
     std::ofstream logFile("./logData/logFile", std::ios::app);
@@ -344,11 +996,131 @@ int main(int argc, char** argv) {
 
 
     
+    // Options: -s save the result, -e choose the engine (default cuda, cpu when no device is found), -f choose the filter,
+    // -c check the CPU engine against the scalar reference, -j decode/encode threads of the batch mode, -bench time the filters,
+    // -u8 blur the 8-bit image directly, -stream blur the image strip by strip (-strip rows)
+    Options options;
+    options.engine = deviceCount > 0 ? Engine::CUDA : Engine::CPU;
+    bool engineGiven = false;   // -e on the command line
+    bool filterGiven = false;   // -f on the command line
+    for (int i = firstArg + 2; i < argc; i++) {
+        std::string option = argv[i];
+        if (option == "-s") {
+            options.save = true;
+        } else if (option == "-c") {
+            options.check = true;
+        } else if (option == "-bench") {
+            options.bench = true;
+        } else if (option == "-u8") {
+            options.u8 = true;
+        } else if (option == "-stream") {
+            options.stream = true;
+        } else if (option == "-strip" && i + 1 < argc) {
+            options.stripRows = atoi(argv[++i]);
+            if (options.stripRows <= 0) {
+                std::cerr << "Error: rows of a strip must be a positive integer." << std::endl;
+                return 1;
+            }
+        } else if (option == "-j" && i + 1 < argc) {
+            options.numThreads = atoi(argv[++i]);
+            if (options.numThreads <= 0) {
+                std::cerr << "Error: number of threads must be a positive integer." << std::endl;
+                return 1;
+            }
+        } else if (option == "-e" && i + 1 < argc) {
+            std::string name = argv[++i];
+            engineGiven = true;
+            if (name == "cpu") {
+                options.engine = Engine::CPU;
+            } else if (name == "cuda") {
+                options.engine = Engine::CUDA;
+            } else {
+                std::cerr << "Error: unknown engine " << name << " (use cuda or cpu)" << std::endl;
+                return 1;
+            }
+        } else if (option == "-f" && i + 1 < argc) {
+            std::string name = argv[++i];
+            filterGiven = true;
+            if (name == "blur") {
+                options.filter = Filter::BLUR;
+            } else if (name == "median3") {
+                options.filter = Filter::MEDIAN3;
+            } else if (name == "median5") {
+                options.filter = Filter::MEDIAN5;
+            } else if (name == "amedian") {
+                options.filter = Filter::ADAPTIVE_MEDIAN;
+            } else {
+                std::cerr << "Error: unknown filter " << name << " (use blur, median3, median5 or amedian)" << std::endl;
+                return 1;
+            }
+        } else {
+            std::cerr << "Error: unknown option " << option << std::endl;
+            return 1;
+        }
+    }
+    if (options.u8 && options.filter != Filter::BLUR) {
+        std::cerr << "Error: -u8 is only available for the blur filter" << std::endl;
+        return 1;
+    }
+    if (batch && options.bench) {
+        std::cerr << "Error: -bench times the filters on a single image, it cannot be used with -b" << std::endl;
+        return 1;
+    }
+    if (options.bench && (options.save || options.check || options.u8 || filterGiven)) {
+        std::cerr << "Error: -bench runs every filter and saves nothing, it cannot be used with -s, -c, -u8 or -f (only -e is used)" << std::endl;
+        return 1;
+    }
+    if (options.stream) {
+        if (options.filter != Filter::BLUR || batch || options.bench) {
+            std::cerr << "Error: -stream is only available for the blur filter on a single image" << std::endl;
+            return 1;
+        }
+        if (engineGiven && options.engine == Engine::CUDA) {
+            std::cerr << "Error: -stream only runs on the CPU engine, use -e cpu or no -e" << std::endl;
+            return 1;
+        }
+        if (options.save || options.check || options.u8) {
+            std::cerr << "Error: -stream cannot be used with -s (the output is always written), -c or -u8 (it is always the -u8 blur)" << std::endl;
+            return 1;
+        }
+        // The strips are filtered by the CPU engine, no device is needed
+        options.engine = Engine::CPU;
+    }
+    if (options.stripRows != STREAM_STRIP_ROWS && !options.stream) {
+        std::cerr << "Error: -strip is only used by -stream" << std::endl;
+        return 1;
+    }
+    if (options.check && options.engine == Engine::CUDA) {
+        std::cerr << "Error: -c compares the CPU engine with the scalar reference, use it with -e cpu" << std::endl;
+        return 1;
+    }
+    if (options.engine == Engine::CUDA && deviceCount == 0) {
+        std::cerr << "Error: no CUDA device found, use -e cpu" << std::endl;
+        return 1;
+    }
+
+    if (batch) {
+        RunBatch(argv[2], argv[3], options, logFile);
+        return 0;
+    }
+
+    if (options.bench) {
+        BenchmarkFilters(argv[1], options, logFile);
+        return 0;
+    }
+
+    // Streaming mode: the output is written while the image is read, so it is always saved
+    if (options.stream) {
+        logFile << argv[1] << ";";
+        StreamBlurJPEG(argv[1], argv[2], options.stripRows, logFile);
+        return 0;
+    }
+
         logFile << argv[1] <<";";
         //std::cout << "Processing image: " << argv[1] << std::endl;
-        cv::Mat result = GetResult(argv[1], logFile);
+        cv::Mat result = GetResult(argv[1], options, logFile);
         //std::cout << "Saving result to: " << argv[2] << std::endl;        
-        if (argc > 3 && argv[3] == std::string("-s")) {
+        if (options.save) {
             cv::imwrite(argv[2], result);
             std::cout << "Result saved successfully image"<< argv[1] << std::endl;
         }
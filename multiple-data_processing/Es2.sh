@@ -1,7 +1,7 @@
 #!/bin/bash
-if [ "$#" -ne 2 ]; then
+if [ "$#" -ne 2 ] && [ "$#" -ne 3 ]; then
     echo "Error: Incorrect number of arguments."
-    echo "Usage: $0 <input_directory> <output_directory>"
+    echo "Usage: $0 <input_directory> <output_directory> [batch|check]"
     exit 1
 fi
 
@@ -13,11 +13,48 @@ export PATH=/usr/local/cuda-11.4/bin:$PATH
 export LD_LIBRARY_PATH=/usr/local/cuda-11.4/lib64:$LD_LIBRARY_PATH
 echo "----------  Starting Compiling  ------------------"
 
-nvcc Es2.cu -o Es2 \
+# CPU engine (OpenMP + SIMD), compiled by the host compiler for the native instruction set
+g++ -O3 -march=native -fopenmp -c Es2_cpu.cpp -o Es2_cpu.o
+g++ -O3 -march=native -fopenmp -c Es2_median.cpp -o Es2_median.o
+# Streaming mode (libjpeg scanline I/O)
+g++ -std=c++17 -O3 -march=native -fopenmp -c Es2_stream.cpp -o Es2_stream.o
+
+nvcc -std=c++17 Es2.cu Es2_cpu.o Es2_median.o Es2_stream.o -o Es2 \
+  -Xcompiler -fopenmp \
   -I/usr/include/opencv4 \
   -L/usr/lib/aarch64-linux-gnu \
   -lopencv_core -lopencv_imgcodecs -lopencv_highgui -lopencv_imgproc \
-  -lstdc++ -lcudart
+  -ljpeg -lstdc++ -lcudart -lgomp
+
+# Check mode: every filter of the CPU engine (and the -u8 blur) must give exactly the scalar reference on every image
+if [ "$3" = "check" ]; then
+    mkdir -p ../logData
+    failed=0
+    for img in "$INPUT_DIR"/*.jpg; do
+        if [ -f "$img" ]; then
+            for filter in blur median3 median5 amedian; do
+                ./Es2 "$img" "$OUTPUT_DIR"/CHECK"$(basename "$img")" -e cpu -c -f "$filter" || failed=1
+            done
+            ./Es2 "$img" "$OUTPUT_DIR"/CHECK"$(basename "$img")" -e cpu -c -u8 || failed=1
+        fi
+    done
+    rm ./Es2 ./Es2_cpu.o ./Es2_median.o ./Es2_stream.o
+    if [ $failed -ne 0 ]; then
+        echo "Check failed: the CPU engine differs from the scalar reference."
+        exit 1
+    fi
+    echo "Check passed."
+    exit 0
+fi
+
+# Batch mode: a single Es2 process for the whole directory, no nsys profile
+if [ "$3" = "batch" ]; then
+    mkdir -p ../logData
+    echo "Processing images in $INPUT_DIR in batch mode"
+    ./Es2 -b "$INPUT_DIR" "$OUTPUT_DIR"
+    rm ./Es2 ./Es2_cpu.o ./Es2_median.o ./Es2_stream.o
+    exit 0
+fi
 
 # Run for each image in noise directory
 mkdir -p ../logData/nsysProfile
@@ -51,4 +88,4 @@ while [ $counter -lt 1 ]; do
     done
     counter=$((counter+1))
 done
-rm ./Es2
+rm ./Es2 ./Es2_cpu.o ./Es2_median.o ./Es2_stream.o
@@ -0,0 +1,339 @@
+#include "Es2_cpu.h"
+#include "Es2_simd.h"
+#include <omp.h>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+
+#define STRIP_ROWS 32  // Minimum number of rows given to a thread at once
+
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+
+                                                        Row helpers of the sliding window
+
+    The kernel rows {1,2,1} and {3,4,3} are applied horizontally once per input row:
+        h1[x] = in[x-1] + 2 in[x] + in[x+1]
+        h3[x] = 3 in[x-1] + 4 in[x] + 3 in[x+1]
+    and each output row is then (h1[y-1] + h3[y] + h1[y+1]) / 16, so every input row is read only once.
+
+------------------------------------------------------------------------------------------------------------------------------------------*/
+
+static void horizontalRow(const float *in, float *h1, float *h3, int CO) {
+    const vfloat two = vset1(2.0f);
+    const vfloat three = vset1(3.0f);
+    const vfloat four = vset1(4.0f);
+    int x = 1;
+    for (; x + SIMD_WIDTH <= CO - 1; x += SIMD_WIDTH) {
+        vfloat left = vload(in + x - 1);
+        vfloat center = vload(in + x);
+        vfloat right = vload(in + x + 1);
+        vfloat sides = vadd(left, right);
+        vstore(h1 + x, vadd(sides, vmul(two, center)));
+        vstore(h3 + x, vadd(vmul(three, sides), vmul(four, center)));
+    }
+    // tail of the row
+    for (; x < CO - 1; x++) {
+        float sides = in[x - 1] + in[x + 1];
+        h1[x] = sides + 2.0f * in[x];
+        h3[x] = 3.0f * sides + 4.0f * in[x];
+    }
+}
+
+static void verticalRow(const float *up, const float *center, const float *down, float *out, int CO) {
+    const vfloat scale = vset1(1.0f / 16.0f);
+    int x = 1;
+    for (; x + SIMD_WIDTH <= CO - 1; x += SIMD_WIDTH) {
+        vfloat sum = vadd(vadd(vload(up + x), vload(center + x)), vload(down + x));
+        vstore(out + x, vmul(scale, sum));
+    }
+    for (; x < CO - 1; x++) {
+        out[x] = (1.0f / 16.0f) * (up[x] + center[x] + down[x]);
+    }
+    // At border it is 0 by default
+    out[0] = 0.0f;
+    out[CO - 1] = 0.0f;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+
+                                                    Filter the rows [y0, y1) of a single channel
+
+    window holds 3 h1 rows and 3 h3 rows used as ring buffers indexed by (row % 3).
+
+------------------------------------------------------------------------------------------------------------------------------------------*/
+
+static void filterStrip(const float *in, float *out, int R, int CO, int y0, int y1, float *window) {
+    float *h1[3] = {window, window + CO, window + 2 * CO};
+    float *h3[3] = {window + 3 * CO, window + 4 * CO, window + 5 * CO};
+
+    // First and last rows of the image are border
+    if (y0 == 0) std::memset(out, 0, CO * sizeof(float));
+    if (y1 == R) std::memset(out + (R - 1) * CO, 0, CO * sizeof(float));
+
+    int first = std::max(y0, 1);
+    int last = std::min(y1, R - 1);
+    if (first >= last) return;
+
+    // Load the halo row above the strip and the first row of the strip
+    horizontalRow(in + (first - 1) * CO, h1[(first - 1) % 3], h3[(first - 1) % 3], CO);
+    horizontalRow(in + first * CO, h1[first % 3], h3[first % 3], CO);
+
+    for (int y = first; y < last; y++) {
+        // Slide the window: the row below is the only new input row
+        horizontalRow(in + (y + 1) * CO, h1[(y + 1) % 3], h3[(y + 1) % 3], CO);
+        verticalRow(h1[(y - 1) % 3], h3[y % 3], h1[(y + 1) % 3], out + y * CO, CO);
+    }
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+
+                                                                    CPU engine
+
+------------------------------------------------------------------------------------------------------------------------------------------*/
+
+void g_x_y_calculation_cpu(const float *channel, float *gxy, int R, int CO, int numChannels) {
+    // Images too small to have an interior are all border
+    if (R < 3 || CO < 3) {
+        std::memset(gxy, 0, (size_t)numChannels * R * CO * sizeof(float));
+        return;
+    }
+
+    // Split the rows in strips: a few strips per thread to balance the load, but not too thin
+    // so that the halo rows recomputed at each strip start stay negligible
+    int stripRows = std::max(STRIP_ROWS, (R + 4 * omp_get_max_threads() - 1) / (4 * omp_get_max_threads()));
+    int numStrips = (R + stripRows - 1) / stripRows;
+
+    #pragma omp parallel
+    {
+        // Per thread sliding window, allocated once and reused for every strip
+        std::vector<float> window(6 * (size_t)CO);
+
+        #pragma omp for collapse(2) schedule(dynamic)
+        for (int z = 0; z < numChannels; z++) {
+            for (int s = 0; s < numStrips; s++) {
+                int y0 = s * stripRows;
+                int y1 = std::min(R, y0 + stripRows);
+                filterStrip(channel + (size_t)z * R * CO, gxy + (size_t)z * R * CO, R, CO, y0, y1, window.data());
+            }
+        }
+    }
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+
+                                                    8-bit interleaved path (integer accumulation)
+
+    Same sliding window as above on rows of CO * cn bytes: the neighbours of element i are i - cn and i + cn.
+    The weights sum to 18, so the weighted sum (at most 18 * 255) needs 16 bits and the result does not fit in 8 bits
+    before the min-max normalization of the float path. Two passes over the input, without any intermediate image:
+        1. the maximum weighted sum of each channel (the minimum is 0, the border)
+        2. out = (sum * scale + 2^24) >> 25 with scale = round(255 * 2^25 / max), which is round(255 * sum / max), the value
+           cv::normalize + convertTo give on the float path, up to one gray level on exact ties
+    The loops are simple enough for the compiler to vectorize them on 16-bit and 64-bit lanes.
+
+------------------------------------------------------------------------------------------------------------------------------------------*/
+
+static void horizontalRowU8(const unsigned char *in, unsigned short *h1, unsigned short *h3, int n, int cn) {
+    #pragma omp simd
+    for (int i = cn; i < n - cn; i++) {
+        unsigned short sides = (unsigned short)(in[i - cn] + in[i + cn]);
+        h1[i] = (unsigned short)(sides + 2 * in[i]);
+        h3[i] = (unsigned short)(3 * sides + 4 * in[i]);
+    }
+}
+
+// First pass: running maximum of every element of the row
+static void maxRowU8(const unsigned short *up, const unsigned short *center, const unsigned short *down,
+                     unsigned short *rowMax, int n, int cn) {
+    #pragma omp simd
+    for (int i = cn; i < n - cn; i++) {
+        unsigned short sum = (unsigned short)(up[i] + center[i] + down[i]);
+        unsigned short current = rowMax[i];
+        rowMax[i] = sum > current ? sum : current;
+    }
+}
+
+// Second pass: normalized output, scale holds the fixed point factor of the channel of every element of the row
+static void verticalRowU8(const unsigned short *up, const unsigned short *center, const unsigned short *down,
+                          unsigned char *out, int n, int cn, const uint64_t *scale) {
+    #pragma omp simd
+    for (int i = cn; i < n - cn; i++) {
+        uint64_t sum = (uint64_t)(up[i] + center[i] + down[i]);
+        out[i] = (unsigned char)((sum * scale[i] + (1ull << (U8_SCALE_BITS - 1))) >> U8_SCALE_BITS);
+    }
+    // At border it is 0 by default
+    for (int c = 0; c < cn; c++) {
+        out[c] = 0;
+        out[n - cn + c] = 0;
+    }
+}
+
+// Output rows [y0, y1) of the image, which must be interior rows; dst points to the output row dstFirst.
+// With scale == nullptr only the maximum is updated, otherwise dst is written
+static void filterStripU8(const unsigned char *src, size_t srcStep, unsigned char *dst, size_t dstStep, int dstFirst, int CO, int cn,
+                          int y0, int y1, unsigned short *window, unsigned short *rowMax, const uint64_t *scale) {
+    int n = CO * cn;
+    unsigned short *h1[3] = {window, window + n, window + 2 * n};
+    unsigned short *h3[3] = {window + 3 * n, window + 4 * n, window + 5 * n};
+    if (y0 >= y1) return;
+
+    horizontalRowU8(src + (y0 - 1) * srcStep, h1[(y0 - 1) % 3], h3[(y0 - 1) % 3], n, cn);
+    horizontalRowU8(src + y0 * srcStep, h1[y0 % 3], h3[y0 % 3], n, cn);
+
+    for (int y = y0; y < y1; y++) {
+        horizontalRowU8(src + (y + 1) * srcStep, h1[(y + 1) % 3], h3[(y + 1) % 3], n, cn);
+        if (scale == nullptr) {
+            maxRowU8(h1[(y - 1) % 3], h3[y % 3], h1[(y + 1) % 3], rowMax, n, cn);
+        } else {
+            verticalRowU8(h1[(y - 1) % 3], h3[y % 3], h1[(y + 1) % 3], dst + (y - dstFirst) * dstStep, n, cn, scale);
+        }
+    }
+}
+
+// Fixed point factor round(255 * 2^25 / max): up to 2^33 when max is 1, so the factor and sum * scale need 64 bits
+static uint64_t normalizationScale(int maxSum) {
+    if (maxSum == 0) return 0;
+    return ((2ull * 255 << U8_SCALE_BITS) + maxSum) / (2ull * maxSum);
+}
+
+// First pass: maxSum[c] = max(maxSum[c], largest weighted sum of channel c on the interior rows)
+static void maxSumU8(const unsigned char *src, size_t srcStep, int R, int CO, int cn, int *maxSum) {
+    int n = CO * cn;
+    std::vector<unsigned short> rowMax(n, 0);
+
+    #pragma omp parallel
+    {
+        std::vector<unsigned short> window(6 * (size_t)n);
+        std::vector<unsigned short> threadMax(n, 0);
+
+        // All the channels are in the same rows, so the strips are the only unit of work
+        int stripRows = std::max(STRIP_ROWS, (R + 4 * omp_get_num_threads() - 1) / (4 * omp_get_num_threads()));
+        int numStrips = (R - 2 + stripRows - 1) / stripRows;
+        #pragma omp for schedule(dynamic)
+        for (int s = 0; s < numStrips; s++) {
+            int y0 = 1 + s * stripRows;
+            filterStripU8(src, srcStep, nullptr, 0, 0, CO, cn, y0, std::min(R - 1, y0 + stripRows), window.data(), threadMax.data(), nullptr);
+        }
+        #pragma omp critical
+        for (int i = 0; i < n; i++) rowMax[i] = std::max(rowMax[i], threadMax[i]);
+    }
+    for (int i = cn; i < n - cn; i++) maxSum[i % cn] = std::max(maxSum[i % cn], (int)rowMax[i]);
+}
+
+// Second pass: normalized output of the interior rows, dst points to the output row dstFirst
+static void writeU8(const unsigned char *src, size_t srcStep, unsigned char *dst, size_t dstStep, int dstFirst,
+                    int R, int CO, int cn, const int *maxSum) {
+    int n = CO * cn;
+    std::vector<uint64_t> scale(n);
+    for (int i = 0; i < n; i++) scale[i] = normalizationScale(maxSum[i % cn]);
+
+    #pragma omp parallel
+    {
+        std::vector<unsigned short> window(6 * (size_t)n);
+        int stripRows = std::max(STRIP_ROWS, (R + 4 * omp_get_num_threads() - 1) / (4 * omp_get_num_threads()));
+        int numStrips = (R - 2 + stripRows - 1) / stripRows;
+        #pragma omp for schedule(dynamic)
+        for (int s = 0; s < numStrips; s++) {
+            int y0 = 1 + s * stripRows;
+            filterStripU8(src, srcStep, dst, dstStep, dstFirst, CO, cn, y0, std::min(R - 1, y0 + stripRows), window.data(), nullptr, scale.data());
+        }
+    }
+}
+
+void g_x_y_calculation_u8_cpu(const unsigned char *src, size_t srcStep, unsigned char *dst, size_t dstStep, int R, int CO, int cn) {
+    // At border it is 0 by default
+    std::memset(dst, 0, (size_t)CO * cn);
+    if (R > 1) std::memset(dst + (R - 1) * dstStep, 0, (size_t)CO * cn);
+    if (R < 3 || CO < 3) {
+        for (int y = 0; y < R; y++) std::memset(dst + y * dstStep, 0, (size_t)CO * cn);
+        return;
+    }
+
+    std::vector<int> maxSum(cn, 0);
+    maxSumU8(src, srcStep, R, CO, cn, maxSum.data());
+    writeU8(src, srcStep, dst, dstStep, 0, R, CO, cn, maxSum.data());
+}
+
+void g_x_y_max_u8_strip(const unsigned char *src, size_t srcStep, int numRows, int CO, int cn, int *maxSum) {
+    if (numRows < 3 || CO < 3) return;
+    maxSumU8(src, srcStep, numRows, CO, cn, maxSum);
+}
+
+void g_x_y_calculation_u8_strip(const unsigned char *src, size_t srcStep, unsigned char *dst, size_t dstStep,
+                                int numRows, int CO, int cn, const int *maxSum) {
+    if (numRows < 3) return;
+    if (CO < 3) {
+        for (int y = 0; y < numRows - 2; y++) std::memset(dst + y * dstStep, 0, (size_t)CO * cn);
+        return;
+    }
+    writeU8(src, srcStep, dst, dstStep, 1, numRows, CO, cn, maxSum);
+}
+
+void g_x_y_calculation_u8_reference(const unsigned char *src, size_t srcStep, unsigned char *dst, size_t dstStep, int R, int CO, int cn) {
+    int W[3][3] = {{1, 2, 1}, {3, 4, 3}, {1, 2, 1}};
+    std::vector<int> sums((size_t)R * CO * cn, 0);
+    std::vector<int> maxSum(cn, 0);
+    for (int y = 1; y < R - 1; y++) {
+        for (int x = 1; x < CO - 1; x++) {
+            for (int c = 0; c < cn; c++) {
+                int sum = 0;
+                for (int i = 0; i < 3; i++) {
+                    for (int j = 0; j < 3; j++) {
+                        sum += W[i][j] * src[(y + i - 1) * srcStep + (x + j - 1) * cn + c];
+                    }
+                }
+                sums[((size_t)y * CO + x) * cn + c] = sum;
+                maxSum[c] = std::max(maxSum[c], sum);
+            }
+        }
+    }
+    // Border sums stay 0
+    for (int y = 0; y < R; y++) {
+        for (int x = 0; x < CO; x++) {
+            for (int c = 0; c < cn; c++) {
+                int sum = sums[((size_t)y * CO + x) * cn + c];
+                dst[y * dstStep + x * cn + c] = (unsigned char)((sum * normalizationScale(maxSum[c]) + (1ull << (U8_SCALE_BITS - 1))) >> U8_SCALE_BITS);
+            }
+        }
+    }
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+
+                                                        Scalar reference (same loop as the CUDA kernel)
+
+------------------------------------------------------------------------------------------------------------------------------------------*/
+
+void g_x_y_calculation_reference(const float *channel, float *gxy, int R, int CO, int numChannels) {
+    int W[3][3] = {{1, 2, 1}, {3, 4, 3}, {1, 2, 1}};
+    for (int z = 0; z < numChannels; z++) {
+        const float *in = channel + (size_t)z * R * CO;
+        float *out = gxy + (size_t)z * R * CO;
+        for (int y = 0; y < R; y++) {
+            for (int x = 0; x < CO; x++) {
+                // At border it is 0 by default
+                if (x == 0 || x >= CO - 1 || y == 0 || y >= R - 1) {
+                    out[y * CO + x] = 0.0f;
+                    continue;
+                }
+                float sum = 0.0f;
+                for (int i = 0; i < 3; i++) {
+                    for (int j = 0; j < 3; j++) {
+                        sum += (1.0f / 16.0f) * W[i][j] * in[(y + i - 1) * CO + (x + j - 1)];
+                    }
+                }
+                out[y * CO + x] = sum;
+            }
+        }
+    }
+}
+
+int cpuThreadCount() {
+    return omp_get_max_threads();
+}
+
+const char *cpuSimdName() {
+    return SIMD_NAME;
+}
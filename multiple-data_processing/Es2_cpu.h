@@ -0,0 +1,67 @@
+#ifndef ES2_CPU_H
+#define ES2_CPU_H
+
+#include <cstddef>
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+
+                                    CPU engine for the 3x3 weighted blur (same semantics as g_x_y_calculation)
+
+    Data layout is the one used by the CUDA kernel: numChannels planes of R x CO floats stored one after the other.
+    The kernel is W = {{1,2,1},{3,4,3},{1,2,1}} / 16 and the pixels on the image border are set to 0.
+
+------------------------------------------------------------------------------------------------------------------------------------------*/
+
+// OpenMP over row strips, SIMD over columns, single pass over the input thanks to a sliding window of row sums
+void g_x_y_calculation_cpu(const float *channel, float *gxy, int R, int CO, int numChannels);
+
+// Plain scalar implementation, same loop as the CUDA kernel. Used to check the engine (-c option of Es2)
+void g_x_y_calculation_reference(const float *channel, float *gxy, int R, int CO, int numChannels);
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+
+                                            Zero-copy path on 8-bit interleaved images (-u8 option of Es2)
+
+    src and dst are R x CO images with cn interleaved channels (the CV_8UC3 cv::Mat given by imread), rows step bytes apart.
+    The weighted sums are accumulated in 16-bit integers and each channel is written already normalized to [0, 255],
+    round(255 * sum / max sum) in fixed point, which is what cv::normalize(NORM_MINMAX) + convertTo(CV_8U) give on the float path
+    (up to one gray level on exact ties).
+
+------------------------------------------------------------------------------------------------------------------------------------------*/
+
+// Fixed point bits of the normalization factor, shared with the CUDA kernel. The largest sum is at most 18 * 255 = 4590 and
+// 4590^2 < 2^25, so the rounding error of the factor cannot move a value that is not an exact tie across a rounding boundary
+#define U8_SCALE_BITS 25
+
+void g_x_y_calculation_u8_cpu(const unsigned char *src, size_t srcStep, unsigned char *dst, size_t dstStep, int R, int CO, int cn);
+void g_x_y_calculation_u8_reference(const unsigned char *src, size_t srcStep, unsigned char *dst, size_t dstStep, int R, int CO, int cn);
+
+// Strip interface of the streaming mode (-stream option of Es2). src holds numRows consecutive rows of the image: the first and the
+// last one are the halo, the other numRows - 2 rows are filtered as interior rows of the image.
+// The first function takes the maximum of maxSum and the sums of the strip; once all the strips have been seen, the second one
+// writes the numRows - 2 normalized rows to dst
+void g_x_y_max_u8_strip(const unsigned char *src, size_t srcStep, int numRows, int CO, int cn, int *maxSum);
+void g_x_y_calculation_u8_strip(const unsigned char *src, size_t srcStep, unsigned char *dst, size_t dstStep,
+                                int numRows, int CO, int cn, const int *maxSum);
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+
+                                        Median filters for salt-and-pepper noise (Es2_median.cpp)
+
+    Same data layout as above. Outside the image the border pixels are replicated, as in cv::medianBlur.
+    size is the side of the window (3 or 5); the adaptive median grows its window from 3x3 up to maxSize x maxSize (at most 7).
+
+------------------------------------------------------------------------------------------------------------------------------------------*/
+
+void median_calculation_cpu(const float *channel, float *out, int R, int CO, int numChannels, int size);
+void adaptive_median_calculation_cpu(const float *channel, float *out, int R, int CO, int numChannels, int maxSize);
+
+// Scalar references (std::nth_element on every window)
+void median_calculation_reference(const float *channel, float *out, int R, int CO, int numChannels, int size);
+void adaptive_median_calculation_reference(const float *channel, float *out, int R, int CO, int numChannels, int maxSize);
+
+// Number of threads the engine will use and name of the SIMD instruction set it was compiled for
+int cpuThreadCount();
+const char *cpuSimdName();
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef ES2_IMAGES_H
+#define ES2_IMAGES_H
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <filesystem>
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+
+                                        Image files of a directory, shared by Es2 -b and AddSP
+
+    Every jpg, jpeg, png, bmp, tif and tiff file (any case), sorted by path so that the order does not depend on the file system.
+
+------------------------------------------------------------------------------------------------------------------------------------------*/
+
+inline std::vector<std::string> ListImageDirectory(const std::string &directory) {
+    std::vector<std::string> paths;
+    for (const auto &entry : std::filesystem::directory_iterator(directory)) {
+        std::string ext = entry.path().extension().string();
+        std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+        if (entry.is_regular_file() &&
+            (ext == ".jpg" || ext == ".jpeg" || ext == ".png" || ext == ".bmp" || ext == ".tif" || ext == ".tiff")) {
+            paths.push_back(entry.path().string());
+        }
+    }
+    std::sort(paths.begin(), paths.end());
+    return paths;
+}
+
+#endif
@@ -0,0 +1,280 @@
+#include "Es2_cpu.h"
+#include "Es2_simd.h"
+#include <omp.h>
+#include <vector>
+#include <algorithm>
+
+#define STRIP_ROWS 32      // Minimum number of rows given to a thread at once
+#define MAX_WINDOW 49      // Values in the biggest window (7x7)
+
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+
+                                                        Selection networks on SIMD registers
+
+    Every lane of a vfloat is a different pixel, so a compare-and-swap (min, max) sorts SIMD_WIDTH windows at once
+    without any branch.
+
+------------------------------------------------------------------------------------------------------------------------------------------*/
+
+static inline void cas(vfloat &a, vfloat &b) {
+    vfloat lo = vmin(a, b);
+    b = vmax(a, b);
+    a = lo;
+}
+
+// Median of 9 values with the 19 compare-and-swap network of Paeth
+static inline vfloat median9(vfloat *p) {
+    cas(p[1], p[2]); cas(p[4], p[5]); cas(p[7], p[8]);
+    cas(p[0], p[1]); cas(p[3], p[4]); cas(p[6], p[7]);
+    cas(p[1], p[2]); cas(p[4], p[5]); cas(p[7], p[8]);
+    cas(p[0], p[3]); cas(p[5], p[8]); cas(p[4], p[7]);
+    cas(p[3], p[6]); cas(p[1], p[4]); cas(p[2], p[5]);
+    cas(p[4], p[7]); cas(p[4], p[2]); cas(p[6], p[4]);
+    cas(p[4], p[2]);
+    return p[4];
+}
+
+// Median of n values (n odd) with the forgetful selection: keep n/2 + 2 candidates, throw away their minimum
+// and their maximum (neither of them can be the median) and bring in the next value, until 3 candidates are left.
+// The loops are fully unrolled so that the candidates can stay in registers
+template <int n>
+static inline vfloat forgetfulMedian(vfloat *p) {
+    const int keep = n / 2 + 2;
+    int first = 0;
+    _Pragma("GCC unroll 32")
+    for (int next = keep; next < n; next++, first++) {
+        _Pragma("GCC unroll 32")
+        for (int i = first + 1; i < keep; i++) cas(p[first], p[i]);          // minimum in p[first]
+        _Pragma("GCC unroll 32")
+        for (int i = first + 1; i < keep - 1; i++) cas(p[i], p[keep - 1]);   // maximum in p[keep - 1]
+        p[keep - 1] = p[next];
+    }
+    cas(p[first], p[first + 1]);
+    cas(p[first + 1], p[first + 2]);
+    cas(p[first], p[first + 1]);
+    return p[first + 1];
+}
+
+template <int n>
+static inline vfloat medianN(vfloat *p) {
+    if (n == 9) return median9(p);
+    return forgetfulMedian<n>(p);
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+
+                                                                Window helpers
+
+------------------------------------------------------------------------------------------------------------------------------------------*/
+
+// Row pointers of the window around row y, replicating the first and last rows outside the image
+static inline void windowRows(const float *in, int R, int CO, int y, int radius, const float **rows) {
+    for (int dy = -radius; dy <= radius; dy++) {
+        rows[dy + radius] = in + (size_t)std::min(std::max(y + dy, 0), R - 1) * CO;
+    }
+}
+
+// Load the (2 radius + 1)^2 vectors of the window centered on column x (no column clamping, interior only)
+template <int radius>
+static inline void loadWindow(const float **rows, int x, vfloat *p) {
+    int n = 0;
+    for (int dy = 0; dy <= 2 * radius; dy++) {
+        for (int dx = -radius; dx <= radius; dx++) {
+            p[n++] = vload(rows[dy] + x + dx);
+        }
+    }
+}
+
+// Scalar version of the window used on the first and last columns, where columns are replicated too
+static inline int loadWindowScalar(const float **rows, int CO, int x, int radius, float *w) {
+    int n = 0;
+    for (int dy = 0; dy <= 2 * radius; dy++) {
+        for (int dx = -radius; dx <= radius; dx++) {
+            w[n++] = rows[dy][std::min(std::max(x + dx, 0), CO - 1)];
+        }
+    }
+    return n;
+}
+
+static inline float medianScalar(float *w, int n) {
+    std::nth_element(w, w + n / 2, w + n);
+    return w[n / 2];
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+
+                                                            Per pixel scalar filters
+
+    Used by the references for every pixel and by the engine for the columns too close to the border for SIMD loads.
+
+------------------------------------------------------------------------------------------------------------------------------------------*/
+
+static float medianPixel(const float *in, int R, int CO, int y, int x, int radius) {
+    const float *rows[7];
+    float w[MAX_WINDOW];
+    windowRows(in, R, CO, y, radius, rows);
+    int n = loadWindowScalar(rows, CO, x, radius, w);
+    return medianScalar(w, n);
+}
+
+// Adaptive median (Gonzalez & Woods): grow the window until its median is not an impulse (zmin < zmed < zmax);
+// then keep the pixel if it is not an impulse itself, otherwise replace it with the median
+static float adaptiveMedianPixel(const float *in, int R, int CO, int y, int x, int maxRadius) {
+    const float *rows[7];
+    float w[MAX_WINDOW];
+    float zxy = in[(size_t)y * CO + x];
+    float zmed = zxy;
+    for (int radius = 1; radius <= maxRadius; radius++) {
+        windowRows(in, R, CO, y, radius, rows);
+        int n = loadWindowScalar(rows, CO, x, radius, w);
+        float zmin = *std::min_element(w, w + n);
+        float zmax = *std::max_element(w, w + n);
+        zmed = medianScalar(w, n);
+        if (zmin < zmed && zmed < zmax) {
+            return (zmin < zxy && zxy < zmax) ? zxy : zmed;
+        }
+    }
+    return zmed;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+
+                                                            Filter the rows [y0, y1) of a channel
+
+------------------------------------------------------------------------------------------------------------------------------------------*/
+
+template <int radius>
+static void medianStrip(const float *in, float *out, int R, int CO, int y0, int y1) {
+    const int n = (2 * radius + 1) * (2 * radius + 1);
+    const float *rows[2 * radius + 1];
+    vfloat p[n];
+    for (int y = y0; y < y1; y++) {
+        windowRows(in, R, CO, y, radius, rows);
+        float *outRow = out + (size_t)y * CO;
+
+        // Columns far enough from the border: SIMD_WIDTH pixels at once
+        int x = radius;
+        for (; x + SIMD_WIDTH <= CO - radius; x += SIMD_WIDTH) {
+            loadWindow<radius>(rows, x, p);
+            vstore(outRow + x, medianN<n>(p));
+        }
+        // Border columns and tail of the row
+        for (int xs = 0; xs < std::min(radius, CO); xs++) outRow[xs] = medianPixel(in, R, CO, y, xs, radius);
+        for (; x < CO; x++) outRow[x] = medianPixel(in, R, CO, y, x, radius);
+    }
+}
+
+// One stage of the adaptive median on SIMD_WIDTH pixels, with the window of the given radius.
+// pending marks the lanes still looking for a window whose median is not an impulse
+template <int radius>
+static inline void adaptiveStage(const float **rows, int x, vfloat zxy, vmask &pending, vfloat &result, bool last) {
+    const int n = (2 * radius + 1) * (2 * radius + 1);
+    vfloat p[n];
+    loadWindow<radius>(rows, x, p);
+    vfloat zmin = p[0], zmax = p[0];
+    for (int i = 1; i < n; i++) {
+        zmin = vmin(zmin, p[i]);
+        zmax = vmax(zmax, p[i]);
+    }
+    vfloat zmed = medianN<n>(p);
+
+    // Stage A: the median is not an impulse, stage B: the pixel is not an impulse
+    vmask stageA = vand(vlt(zmin, zmed), vlt(zmed, zmax));
+    vmask stageB = vand(vlt(zmin, zxy), vlt(zxy, zmax));
+    vmask done = vand(pending, stageA);
+    result = vselect(done, vselect(stageB, zxy, zmed), result);
+    pending = vandnot(stageA, pending);
+
+    // Window at its maximum size: the median is the output anyway
+    if (last) result = vselect(pending, zmed, result);
+}
+
+static void adaptiveMedianStrip(const float *in, float *out, int R, int CO, int y0, int y1, int maxRadius) {
+    const float *rows[7];
+    for (int y = y0; y < y1; y++) {
+        // Rows of the biggest window, the smaller windows use the central ones
+        windowRows(in, R, CO, y, maxRadius, rows);
+        float *outRow = out + (size_t)y * CO;
+
+        int x = maxRadius;
+        for (; x + SIMD_WIDTH <= CO - maxRadius; x += SIMD_WIDTH) {
+            vfloat zxy = vload(in + (size_t)y * CO + x);
+            vfloat result = zxy;
+            vmask pending = vtrue();
+            adaptiveStage<1>(rows + maxRadius - 1, x, zxy, pending, result, maxRadius == 1);
+            if (maxRadius >= 2 && vany(pending)) adaptiveStage<2>(rows + maxRadius - 2, x, zxy, pending, result, maxRadius == 2);
+            if (maxRadius >= 3 && vany(pending)) adaptiveStage<3>(rows, x, zxy, pending, result, true);
+            vstore(outRow + x, result);
+        }
+        for (int xs = 0; xs < std::min(maxRadius, CO); xs++) outRow[xs] = adaptiveMedianPixel(in, R, CO, y, xs, maxRadius);
+        for (; x < CO; x++) outRow[x] = adaptiveMedianPixel(in, R, CO, y, x, maxRadius);
+    }
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+
+                                                                    CPU engine
+
+------------------------------------------------------------------------------------------------------------------------------------------*/
+
+// Same strip decomposition as the blur: a few strips per thread, channels and strips shared among the threads
+template <typename StripFunction>
+static void forEachStrip(const float *channel, float *out, int R, int CO, int numChannels, StripFunction strip) {
+    int stripRows = std::max(STRIP_ROWS, (R + 4 * omp_get_max_threads() - 1) / (4 * omp_get_max_threads()));
+    int numStrips = (R + stripRows - 1) / stripRows;
+
+    #pragma omp parallel for collapse(2) schedule(dynamic)
+    for (int z = 0; z < numChannels; z++) {
+        for (int s = 0; s < numStrips; s++) {
+            int y0 = s * stripRows;
+            int y1 = std::min(R, y0 + stripRows);
+            strip(channel + (size_t)z * R * CO, out + (size_t)z * R * CO, y0, y1);
+        }
+    }
+}
+
+void median_calculation_cpu(const float *channel, float *out, int R, int CO, int numChannels, int size) {
+    forEachStrip(channel, out, R, CO, numChannels, [=](const float *in, float *o, int y0, int y1) {
+        if (size == 5) {
+            medianStrip<2>(in, o, R, CO, y0, y1);
+        } else {
+            medianStrip<1>(in, o, R, CO, y0, y1);
+        }
+    });
+}
+
+void adaptive_median_calculation_cpu(const float *channel, float *out, int R, int CO, int numChannels, int maxSize) {
+    int maxRadius = std::min(std::max(maxSize / 2, 1), 3);
+    forEachStrip(channel, out, R, CO, numChannels, [=](const float *in, float *o, int y0, int y1) {
+        adaptiveMedianStrip(in, o, R, CO, y0, y1, maxRadius);
+    });
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+
+                                                                Scalar references
+
+------------------------------------------------------------------------------------------------------------------------------------------*/
+
+void median_calculation_reference(const float *channel, float *out, int R, int CO, int numChannels, int size) {
+    for (int z = 0; z < numChannels; z++) {
+        const float *in = channel + (size_t)z * R * CO;
+        for (int y = 0; y < R; y++) {
+            for (int x = 0; x < CO; x++) {
+                out[(size_t)z * R * CO + (size_t)y * CO + x] = medianPixel(in, R, CO, y, x, size / 2);
+            }
+        }
+    }
+}
+
+void adaptive_median_calculation_reference(const float *channel, float *out, int R, int CO, int numChannels, int maxSize) {
+    for (int z = 0; z < numChannels; z++) {
+        const float *in = channel + (size_t)z * R * CO;
+        for (int y = 0; y < R; y++) {
+            for (int x = 0; x < CO; x++) {
+                out[(size_t)z * R * CO + (size_t)y * CO + x] = adaptiveMedianPixel(in, R, CO, y, x, std::min(std::max(maxSize / 2, 1), 3));
+            }
+        }
+    }
+}
@@ -0,0 +1,54 @@
+#ifndef ES2_QUEUE_H
+#define ES2_QUEUE_H
+
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+
+                                            Bounded producer/consumer queue used between pipeline stages
+
+    push() blocks while the queue is full, so a fast stage cannot keep more than "capacity" images in memory.
+    pop() blocks while the queue is empty and returns false once the queue is closed and drained.
+
+------------------------------------------------------------------------------------------------------------------------------------------*/
+
+template <typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity) : capacity(capacity), closed(false) {}
+
+    void push(T item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        notFull.wait(lock, [this] { return items.size() < capacity; });
+        items.push_back(std::move(item));
+        notEmpty.notify_one();
+    }
+
+    bool pop(T &item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        notEmpty.wait(lock, [this] { return !items.empty() || closed; });
+        if (items.empty()) return false;
+        item = std::move(items.front());
+        items.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+
+    // No more items will be pushed: wake up all the consumers
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        notEmpty.notify_all();
+    }
+
+private:
+    size_t capacity;
+    bool closed;
+    std::deque<T> items;
+    std::mutex mutex;
+    std::condition_variable notEmpty, notFull;
+};
+
+#endif
@@ -0,0 +1,94 @@
+#ifndef ES2_SIMD_H
+#define ES2_SIMD_H
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+
+                                    Thin wrapper over the float SIMD registers used by the CPU engine
+
+    The width is picked at compile time from the flags given to the compiler (-march=native in Es2.sh):
+    AVX-512 -> 16 floats, AVX2 -> 8 floats, NEON (aarch64 nodes) -> 4 floats, otherwise 1 float (plain scalar).
+    vmask is the result of a lane by lane comparison, vselect(m, a, b) takes a where m is set and b elsewhere.
+
+------------------------------------------------------------------------------------------------------------------------------------------*/
+
+#if defined(__AVX512F__)
+#include <immintrin.h>
+#define SIMD_NAME "AVX-512"
+#define SIMD_WIDTH 16
+typedef __m512 vfloat;
+static inline vfloat vload(const float *p)           { return _mm512_loadu_ps(p); }
+static inline void   vstore(float *p, vfloat a)      { _mm512_storeu_ps(p, a); }
+static inline vfloat vset1(float a)                  { return _mm512_set1_ps(a); }
+static inline vfloat vadd(vfloat a, vfloat b)        { return _mm512_add_ps(a, b); }
+static inline vfloat vmul(vfloat a, vfloat b)        { return _mm512_mul_ps(a, b); }
+static inline vfloat vmin(vfloat a, vfloat b)        { return _mm512_min_ps(a, b); }
+static inline vfloat vmax(vfloat a, vfloat b)        { return _mm512_max_ps(a, b); }
+typedef __mmask16 vmask;
+static inline vmask  vlt(vfloat a, vfloat b)         { return _mm512_cmp_ps_mask(a, b, _CMP_LT_OQ); }
+static inline vmask  vand(vmask a, vmask b)          { return a & b; }
+static inline vmask  vandnot(vmask a, vmask b)       { return (vmask)(~a & b); }
+static inline vmask  vtrue()                         { return (vmask)0xFFFF; }
+static inline vfloat vselect(vmask m, vfloat a, vfloat b) { return _mm512_mask_blend_ps(m, b, a); }
+static inline bool   vany(vmask m)                   { return m != 0; }
+
+#elif defined(__AVX2__)
+#include <immintrin.h>
+#define SIMD_NAME "AVX2"
+#define SIMD_WIDTH 8
+typedef __m256 vfloat;
+static inline vfloat vload(const float *p)           { return _mm256_loadu_ps(p); }
+static inline void   vstore(float *p, vfloat a)      { _mm256_storeu_ps(p, a); }
+static inline vfloat vset1(float a)                  { return _mm256_set1_ps(a); }
+static inline vfloat vadd(vfloat a, vfloat b)        { return _mm256_add_ps(a, b); }
+static inline vfloat vmul(vfloat a, vfloat b)        { return _mm256_mul_ps(a, b); }
+static inline vfloat vmin(vfloat a, vfloat b)        { return _mm256_min_ps(a, b); }
+static inline vfloat vmax(vfloat a, vfloat b)        { return _mm256_max_ps(a, b); }
+typedef __m256 vmask;
+static inline vmask  vlt(vfloat a, vfloat b)         { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+static inline vmask  vand(vmask a, vmask b)          { return _mm256_and_ps(a, b); }
+static inline vmask  vandnot(vmask a, vmask b)       { return _mm256_andnot_ps(a, b); }
+static inline vmask  vtrue()                         { return _mm256_castsi256_ps(_mm256_set1_epi32(-1)); }
+static inline vfloat vselect(vmask m, vfloat a, vfloat b) { return _mm256_blendv_ps(b, a, m); }
+static inline bool   vany(vmask m)                   { return _mm256_movemask_ps(m) != 0; }
+
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define SIMD_NAME "NEON"
+#define SIMD_WIDTH 4
+typedef float32x4_t vfloat;
+static inline vfloat vload(const float *p)           { return vld1q_f32(p); }
+static inline void   vstore(float *p, vfloat a)      { vst1q_f32(p, a); }
+static inline vfloat vset1(float a)                  { return vdupq_n_f32(a); }
+static inline vfloat vadd(vfloat a, vfloat b)        { return vaddq_f32(a, b); }
+static inline vfloat vmul(vfloat a, vfloat b)        { return vmulq_f32(a, b); }
+static inline vfloat vmin(vfloat a, vfloat b)        { return vminq_f32(a, b); }
+static inline vfloat vmax(vfloat a, vfloat b)        { return vmaxq_f32(a, b); }
+typedef uint32x4_t vmask;
+static inline vmask  vlt(vfloat a, vfloat b)         { return vcltq_f32(a, b); }
+static inline vmask  vand(vmask a, vmask b)          { return vandq_u32(a, b); }
+static inline vmask  vandnot(vmask a, vmask b)       { return vbicq_u32(b, a); }
+static inline vmask  vtrue()                         { return vdupq_n_u32(0xFFFFFFFFu); }
+static inline vfloat vselect(vmask m, vfloat a, vfloat b) { return vbslq_f32(m, a, b); }
+static inline bool   vany(vmask m)                   { return vmaxvq_u32(m) != 0; }
+
+#else
+#define SIMD_NAME "scalar"
+#define SIMD_WIDTH 1
+typedef float vfloat;
+static inline vfloat vload(const float *p)           { return *p; }
+static inline void   vstore(float *p, vfloat a)      { *p = a; }
+static inline vfloat vset1(float a)                  { return a; }
+static inline vfloat vadd(vfloat a, vfloat b)        { return a + b; }
+static inline vfloat vmul(vfloat a, vfloat b)        { return a * b; }
+static inline vfloat vmin(vfloat a, vfloat b)        { return b < a ? b : a; }
+static inline vfloat vmax(vfloat a, vfloat b)        { return a < b ? b : a; }
+typedef bool vmask;
+static inline vmask  vlt(vfloat a, vfloat b)         { return a < b; }
+static inline vmask  vand(vmask a, vmask b)          { return a && b; }
+static inline vmask  vandnot(vmask a, vmask b)       { return !a && b; }
+static inline vmask  vtrue()                         { return true; }
+static inline vfloat vselect(vmask m, vfloat a, vfloat b) { return m ? a : b; }
+static inline bool   vany(vmask m)                   { return m; }
+#endif
+
+#endif
@@ -0,0 +1,243 @@
+#include "Es2_stream.h"
+#include "Es2_cpu.h"
+#include "Es2_queue.h"
+#include <cstdio>
+#include <cstdlib>
+#include <jpeglib.h>
+#include <iostream>
+#include <vector>
+#include <thread>
+#include <functional>
+#include <chrono>
+#include <algorithm>
+#include <filesystem>
+
+#define STREAM_QUEUE 2    // Strips waiting between two stages of the pipeline
+#define JPEG_QUALITY 95   // Same default quality as cv::imwrite
+
+// Horizontal strip of the image travelling through the pipeline
+struct Strip {
+    int y0 = 0, y1 = 0;     // output rows [y0, y1)
+    int numRows = 0;        // rows held in data: the output rows and their halo, starting at row max(y0 - 1, 0)
+    std::vector<unsigned char> data;
+};
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+
+                                                    JPEG scanline input and output (libjpeg)
+
+    The libjpeg default error handler prints the error and exits, as the rest of Es2 does on I/O errors.
+
+------------------------------------------------------------------------------------------------------------------------------------------*/
+
+struct JpegInput {
+    FILE *file;
+    jpeg_decompress_struct cinfo;
+    jpeg_error_mgr jerr;
+};
+
+static void openInput(JpegInput &in, const std::string &path) {
+    in.file = fopen(path.c_str(), "rb");
+    if (in.file == nullptr) {
+        std::cerr << "Error: Could not open or find the image!" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    in.cinfo.err = jpeg_std_error(&in.jerr);
+    jpeg_create_decompress(&in.cinfo);
+    jpeg_stdio_src(&in.cinfo, in.file);
+    jpeg_read_header(&in.cinfo, TRUE);
+    in.cinfo.out_color_space = JCS_RGB;   // grayscale images are expanded to 3 channels, as imread(IMREAD_COLOR) does
+}
+
+// finish = false when the image was not decoded (only the header was needed)
+static void closeInput(JpegInput &in, bool finish) {
+    if (finish) jpeg_finish_decompress(&in.cinfo);
+    jpeg_destroy_decompress(&in.cinfo);
+    fclose(in.file);
+}
+
+// Decode count rows into rows, rowBytes apart
+static void readRows(JpegInput &in, unsigned char *rows, size_t rowBytes, int count) {
+    for (int done = 0; done < count;) {
+        JSAMPROW row = rows + done * rowBytes;
+        done += jpeg_read_scanlines(&in.cinfo, &row, 1);
+    }
+}
+
+struct JpegOutput {
+    FILE *file;
+    jpeg_compress_struct cinfo;
+    jpeg_error_mgr jerr;
+};
+
+static void openOutput(JpegOutput &out, const std::string &path, int R, int C) {
+    out.file = fopen(path.c_str(), "wb");
+    if (out.file == nullptr) {
+        std::cerr << "Error: Could not save the image " << path << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    out.cinfo.err = jpeg_std_error(&out.jerr);
+    jpeg_create_compress(&out.cinfo);
+    jpeg_stdio_dest(&out.cinfo, out.file);
+    out.cinfo.image_width = C;
+    out.cinfo.image_height = R;
+    out.cinfo.input_components = 3;
+    out.cinfo.in_color_space = JCS_RGB;
+    jpeg_set_defaults(&out.cinfo);
+    jpeg_set_quality(&out.cinfo, JPEG_QUALITY, TRUE);
+    jpeg_start_compress(&out.cinfo, TRUE);
+}
+
+static void closeOutput(JpegOutput &out) {
+    jpeg_finish_compress(&out.cinfo);
+    jpeg_destroy_compress(&out.cinfo);
+    fclose(out.file);
+}
+
+static void writeRows(JpegOutput &out, const unsigned char *rows, size_t rowBytes, int count) {
+    for (int done = 0; done < count;) {
+        JSAMPROW row = const_cast<unsigned char *>(rows + done * rowBytes);
+        done += jpeg_write_scanlines(&out.cinfo, &row, 1);
+    }
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+
+                                                                Reader stage
+
+    Every strip holds the rows [max(y0 - 1, 0), min(y1 + 1, R)). Consecutive strips share two rows (the last output row and the
+    halo): they are copied from the previous strip, so every row of the file is decoded once per pass.
+
+------------------------------------------------------------------------------------------------------------------------------------------*/
+
+static void readStrips(const std::string &path, int stripRows, BoundedQueue<Strip> &queue) {
+    JpegInput in;
+    openInput(in, path);
+    jpeg_start_decompress(&in.cinfo);
+    int R = in.cinfo.output_height;
+    size_t rowBytes = (size_t)in.cinfo.output_width * 3;
+
+    std::vector<unsigned char> shared(2 * rowBytes);   // last two rows decoded
+    int nextRow = 0;                                    // next row of the file
+    for (int y0 = 0; y0 < R; y0 += stripRows) {
+        Strip strip;
+        strip.y0 = y0;
+        strip.y1 = std::min(R, y0 + stripRows);
+        int first = std::max(y0 - 1, 0);
+        int last = std::min(strip.y1 + 1, R);
+        strip.numRows = last - first;
+        strip.data.resize(strip.numRows * rowBytes);
+
+        int reused = nextRow - first;
+        std::copy(shared.end() - reused * rowBytes, shared.end(), strip.data.begin());
+        readRows(in, strip.data.data() + reused * rowBytes, rowBytes, last - nextRow);
+        nextRow = last;
+
+        int keep = std::min(strip.numRows, 2);
+        std::copy(strip.data.end() - keep * rowBytes, strip.data.end(), shared.end() - keep * rowBytes);
+        queue.push(std::move(strip));
+    }
+    queue.close();
+    closeInput(in, true);
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+
+                                                        Two passes over the image
+
+------------------------------------------------------------------------------------------------------------------------------------------*/
+
+void StreamBlurJPEG(const std::string &inputPath, const std::string &outputPath, int stripRows, std::ofstream &logFile) {
+    for (const std::string &path : {inputPath, outputPath}) {
+        std::string ext = std::filesystem::path(path).extension().string();
+        std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+        if (ext != ".jpg" && ext != ".jpeg") {
+            std::cerr << "Error: the streaming mode only reads and writes JPEG images (" << path << ")" << std::endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+    // The output is opened while the input is still being decoded, writing in place would truncate the input
+    std::error_code error;
+    if (std::filesystem::equivalent(inputPath, outputPath, error)) {
+        std::cerr << "Error: the streaming mode cannot write the output over its input (" << outputPath << ")" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    // Only the header, to know the size of the image
+    int R, C;
+    {
+        JpegInput in;
+        openInput(in, inputPath);
+        R = in.cinfo.image_height;
+        C = in.cinfo.image_width;
+        closeInput(in, false);
+    }
+    size_t rowBytes = (size_t)C * 3;
+    logFile << std::to_string(R) << ";" << std::to_string(C) << ";" << cpuThreadCount() << ";";
+
+    auto start = std::chrono::high_resolution_clock::now();
+    double milliseconds = 0.0;
+
+    // First pass: largest weighted sum of each channel
+    int maxSum[3] = {0, 0, 0};
+    {
+        BoundedQueue<Strip> decoded(STREAM_QUEUE);
+        std::thread reader(readStrips, inputPath, stripRows, std::ref(decoded));
+        Strip strip;
+        while (decoded.pop(strip)) {
+            auto t0 = std::chrono::high_resolution_clock::now();
+            g_x_y_max_u8_strip(strip.data.data(), rowBytes, strip.numRows, C, 3, maxSum);
+            milliseconds += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - t0).count();
+        }
+        reader.join();
+    }
+
+    // Second pass: read -> filter -> write
+    {
+        BoundedQueue<Strip> decoded(STREAM_QUEUE);
+        BoundedQueue<Strip> filtered(STREAM_QUEUE);
+        std::thread reader(readStrips, inputPath, stripRows, std::ref(decoded));
+        std::thread writer([&] {
+            JpegOutput out;
+            openOutput(out, outputPath, R, C);
+            Strip strip;
+            while (filtered.pop(strip)) {
+                writeRows(out, strip.data.data(), rowBytes, strip.y1 - strip.y0);
+            }
+            closeOutput(out);
+        });
+
+        Strip strip;
+        while (decoded.pop(strip)) {
+            auto t0 = std::chrono::high_resolution_clock::now();
+            Strip result;
+            result.y0 = strip.y0;
+            result.y1 = strip.y1;
+            result.numRows = strip.y1 - strip.y0;
+            result.data.resize(result.numRows * rowBytes);
+
+            // At border it is 0 by default, the other rows are the interior rows of the strip
+            if (strip.y0 == 0) std::fill(result.data.begin(), result.data.begin() + rowBytes, 0);
+            if (strip.y1 == R) std::fill(result.data.end() - rowBytes, result.data.end(), 0);
+            int firstInterior = std::max(strip.y0 - 1, 0) + 1;
+            g_x_y_calculation_u8_strip(strip.data.data(), rowBytes, result.data.data() + (firstInterior - strip.y0) * rowBytes, rowBytes,
+                                       strip.numRows, C, 3, maxSum);
+            milliseconds += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - t0).count();
+            filtered.push(std::move(result));
+        }
+        filtered.close();
+        reader.join();
+        writer.join();
+    }
+
+    logFile << std::to_string(milliseconds) << ";";
+    auto end = std::chrono::high_resolution_clock::now();
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+    logFile << std::to_string(elapsed) << "\n";
+
+    // Strips alive at the same time on each side of the filter stage: the one held by the producer, the ones in the queue
+    // and the one held by the consumer
+    double stripMB = (double)(std::min(stripRows, R) + 2) * rowBytes / (1024.0 * 1024.0);
+    std::cout << "Streamed " << R << "x" << C << " in strips of " << stripRows << " rows, at most "
+              << 2 * (STREAM_QUEUE + 2) * stripMB << " MB of strip buffers" << std::endl;
+}
@@ -0,0 +1,21 @@
+#ifndef ES2_STREAM_H
+#define ES2_STREAM_H
+
+#include <string>
+#include <fstream>
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+
+                                            Streaming mode for images bigger than the memory (-stream option of Es2)
+
+    The JPEG image is read, blurred and written in horizontal strips of stripRows rows (plus one halo row above and below),
+    so the memory used depends on the width of the image and on stripRows, not on its height. A reader thread decodes the
+    next strip and a writer thread encodes the previous one while the CPU engine filters the current one.
+    The result is the one of the -u8 path. The per-channel normalization needs the largest weighted sum of the whole image,
+    so the input is decoded twice: a first pass only looks for the maximum, the second one writes the output.
+
+------------------------------------------------------------------------------------------------------------------------------------------*/
+
+void StreamBlurJPEG(const std::string &inputPath, const std::string &outputPath, int stripRows, std::ofstream &logFile);
+
+#endif